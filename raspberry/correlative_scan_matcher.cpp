@@ -0,0 +1,325 @@
+#include "correlative_scan_matcher.h"
+#include "distance_field.h"
+#include "scanmatching.h"
+#include "robot_configuration.h"
+#include "thread_pool.h"
+
+#include <boost/range/algorithm/sort.hpp>
+#include <boost/range/algorithm/remove_if.hpp>
+#include <boost/algorithm/cxx11/any_of.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+CCorrelativeTables::CCorrelativeTables()
+    : m_rectnInvalid(rbt::rect<int>::empty())
+{}
+
+void CCorrelativeTables::update(CDistanceField const& distfield, int cLevels) {
+    ASSERT(0<cLevels);
+    // Level 0 cells to recompute
+    auto rectn = rbt::rect<int>::empty();
+    if(cLevels<LevelCount()) m_vecgridnLevel.erase(m_vecgridnLevel.begin() + cLevels, m_vecgridnLevel.end());
+    if(LevelCount()<cLevels) {
+        m_vecgridnLevel.assign(cLevels, CTiledGrid<std::uint8_t>(0));
+        rectn = distfield.bounds();
+    } else if(m_rectnInvalid.left<=m_rectnInvalid.right) {
+        // Distances change up to c_nMaxObstacleDistance around the invalidated cells
+        rectn = rbt::rect<int>{
+            m_rectnInvalid.left - c_nMaxObstacleDistance, m_rectnInvalid.bottom - c_nMaxObstacleDistance,
+            m_rectnInvalid.right + c_nMaxObstacleDistance, m_rectnInvalid.top + c_nMaxObstacleDistance
+        };
+    }
+    m_rectnInvalid = rbt::rect<int>::empty();
+    if(rectn.right<rectn.left) return; // nothing changed
+
+    auto Store = [](CTiledGrid<std::uint8_t>& gridn, rbt::rect<int> const& rectn, cv::Mat const& matn) {
+        for(int y = rectn.bottom; y <= rectn.top; ++y) {
+            auto const* pn = matn.ptr<std::uint8_t>(y - rectn.bottom);
+            for(int x = rectn.left; x <= rectn.right; ++x, ++pn) {
+                rbt::point<int> const pt(x, y);
+                // Don't copy shared tiles if nothing changes
+                if(*pn!=gridn.at(pt)) gridn.ref(pt) = *pn;
+            }
+        }
+    };
+
+    auto const matfDistance = distfield.ToMat(rectn);
+    cv::Mat matnScore(matfDistance.rows, matfDistance.cols, CV_8UC1);
+    for(int y = 0; y < matfDistance.rows; ++y) {
+        auto const* pf = matfDistance.ptr<float>(y);
+        auto* pn = matnScore.ptr<std::uint8_t>(y);
+        for(int x = 0; x < matfDistance.cols; ++x) {
+            pn[x] = static_cast<std::uint8_t>(std::lround(255 * std::exp(-rbt::sqr(pf[x]) / (2 * rbt::sqr(c_fCorrelativeSigma)))));
+        }
+    }
+    Store(m_vecgridnLevel[0], rectn, matnScore);
+
+    for(int nLevel = 1; nLevel < cLevels; ++nLevel) {
+        // Level n is the maximum of the level n-1 cells at offsets 0 and 2^(n-1) in x and y,
+        // so it changes for the cells up to 2^(n-1) left of and below the changed cells of level n-1
+        int const nHalf = 1 << (nLevel - 1);
+        rectn = rbt::rect<int>{rectn.left - nHalf, rectn.bottom - nHalf, rectn.right, rectn.top};
+        auto const matnFine = m_vecgridnLevel[nLevel - 1].ToMat(
+            rbt::rect<int>{rectn.left, rectn.bottom, rectn.right + nHalf, rectn.top + nHalf}
+        );
+        auto Shifted = [&](int x, int y) {
+            return matnFine(cv::Rect(x, y, rectn.right - rectn.left + 1, rectn.top - rectn.bottom + 1));
+        };
+        cv::Mat matnMax0;
+        cv::Mat matnMax1;
+        cv::Mat matnMax;
+        cv::max(Shifted(0, 0), Shifted(nHalf, 0), matnMax0);
+        cv::max(Shifted(0, nHalf), Shifted(nHalf, nHalf), matnMax1);
+        cv::max(matnMax0, matnMax1, matnMax);
+        Store(m_vecgridnLevel[nLevel], rectn, matnMax);
+    }
+}
+
+cv::Mat CCorrelativeTables::ToMat(int nLevel, rbt::rect<int> const& rectn) const {
+    ASSERT(0<=nLevel && nLevel<LevelCount());
+    return m_vecgridnLevel[nLevel].ToMat(rectn);
+}
+
+namespace {
+    // Region of 2^m_nLevel x 2^m_nLevel translations starting at m_szn, for rotation m_iAngle
+    struct SCandidate {
+        std::size_t m_iAngle;
+        rbt::size<int> m_szn;
+        int m_nLevel;
+        int m_nScore;
+    };
+
+    struct SBranchAndBound {
+        // Rotates the scan points by every angle in vecfYaw around ptfWorld and copies cLevels lookup
+        // tables covering the scan points translated by all translations in rectnTranslation (in px)
+        SBranchAndBound(
+            SScanLine const& scanline, rbt::point<double> const& ptfWorld, std::vector<double> const& vecfYaw, 
+            rbt::rect<int> const& rectnTranslation, CCorrelativeTables const& tables, int cLevels
+        ) 
+            : m_rectnTranslation(rectnTranslation)
+        {
+            ASSERT(cLevels<=tables.LevelCount());
+            auto rectnScan = rbt::rect<int>::empty();
+            boost::for_each(vecfYaw, [&](double fYaw) {
+                rbt::pose<double> const pose(ptfWorld, fYaw);
+                m_vecvecpt.emplace_back();
+                boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
+                    m_vecvecpt.back().emplace_back(ToGridCoordinate(Obstacle(pose, scan.m_fRadAngle, scan.m_nDistance)));
+                    rectnScan |= m_vecvecpt.back().back();
+                });
+            });
+
+            rbt::rect<int> const rectnWindow{
+                rectnScan.left + rectnTranslation.left, rectnScan.bottom + rectnTranslation.bottom,
+                rectnScan.right + rectnTranslation.right, rectnScan.top + rectnTranslation.top
+            };
+            boost::for_each(m_vecvecpt, [&](std::vector<rbt::point<int>>& vecpt) {
+                boost::for_each(vecpt, [&](rbt::point<int>& pt) {
+                    pt -= rbt::size<int>(rectnWindow.left, rectnWindow.bottom);
+                });
+            });
+
+            for(int nLevel = 0; nLevel < cLevels; ++nLevel) {
+                m_vecmatnTable.emplace_back(tables.ToMat(nLevel, rectnWindow));
+            }
+        }
+
+        int score(SCandidate const& cand) const {
+            auto const& matn = m_vecmatnTable[cand.m_nLevel];
+            int nScore = 0;
+            boost::for_each(m_vecvecpt[cand.m_iAngle], [&](rbt::point<int> const& pt) {
+                nScore += matn.at<std::uint8_t>(pt.y + cand.m_szn.y, pt.x + cand.m_szn.x);
+            });
+            return nScore;
+        }
+
+        SCandidate candidate(std::size_t iAngle, rbt::size<int> const& szn, int nLevel) const {
+            SCandidate cand{iAngle, szn, nLevel, 0};
+            cand.m_nScore = score(cand);
+            return cand;
+        }
+
+        // Candidates at nLevel covering all translations for rotation iAngle
+        void candidates(std::size_t iAngle, int nLevel, std::vector<SCandidate>& veccand) const {
+            for(int y = m_rectnTranslation.bottom; y <= m_rectnTranslation.top; y += 1 << nLevel) {
+                for(int x = m_rectnTranslation.left; x <= m_rectnTranslation.right; x += 1 << nLevel) {
+                    veccand.emplace_back(candidate(iAngle, rbt::size<int>(x, y), nLevel));
+                }
+            }
+        }
+
+        // Depth first search, visiting the candidates with the highest upper bound first.
+        // Calls fnLeaf(cand) for every single translation scoring more than nScoreMin,
+        // fnLeaf may raise nScoreMin.
+        template<typename FLeaf>
+        void search(std::vector<SCandidate>& veccand, int& nScoreMin, FLeaf fnLeaf) const {
+            boost::sort(veccand, [](SCandidate const& lhs, SCandidate const& rhs) {
+                return lhs.m_nScore > rhs.m_nScore;
+            });
+            for(auto const& cand : veccand) {
+                if(cand.m_nScore <= nScoreMin) break; // all remaining candidates are bounded by cand
+
+                if(0==cand.m_nLevel) {
+                    fnLeaf(cand);
+                } else {
+                    int const nHalf = 1 << (cand.m_nLevel - 1);
+                    std::vector<SCandidate> veccandChildren;
+                    for(int y : {0, nHalf}) {
+                        for(int x : {0, nHalf}) {
+                            auto const szn = cand.m_szn + rbt::size<int>(x, y);
+                            if(m_rectnTranslation.right < szn.x || m_rectnTranslation.top < szn.y) continue;
+                            veccandChildren.emplace_back(candidate(cand.m_iAngle, szn, cand.m_nLevel - 1));
+                        }
+                    }
+                    search(veccandChildren, nScoreMin, fnLeaf);
+                }
+            }
+        }
+
+        // Scan points of every rotation, relative to the lower left corner of the lookup tables
+        std::vector<std::vector<rbt::point<int>>> m_vecvecpt;
+        // Level n stores the maximum score of the 2^n x 2^n cells above and right of each cell
+        std::vector<cv::Mat> m_vecmatnTable;
+        rbt::rect<int> m_rectnTranslation; // inclusive
+    };
+
+    // Choose the angular step so that the furthest scan point moves by at most 1px
+    double AngleStep(SScanLine const& scanline) {
+        int nDistanceMax = 0;
+        boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
+            nDistanceMax = std::max(nDistanceMax, scan.m_nDistance);
+        });
+        double const fRange = std::max(static_cast<double>(nDistanceMax) / c_nScale, 1.0);
+        return std::acos(1 - 1 / (2 * rbt::sqr(fRange)));
+    }
+
+    // Keeps the cHypotheses best hypotheses in vechyp, sorted by descending score.
+    // Of several hypotheses closer than c_nRelocalizationSeparation and 
+    // c_fRelocalizationSeparationAngle, only the best one is kept.
+    void AddHypothesis(std::vector<SPoseHypothesis>& vechyp, SPoseHypothesis const& hyp, std::size_t cHypotheses) {
+        auto Near = [&](SPoseHypothesis const& hypOther) {
+            return (hypOther.m_pose.m_pt - hyp.m_pose.m_pt).SqrAbs() < rbt::sqr(c_nRelocalizationSeparation * c_nScale)
+                && std::abs(std::remainder(hypOther.m_pose.m_fYaw - hyp.m_pose.m_fYaw, 2*M_PI)) < rbt::rad(c_fRelocalizationSeparationAngle);
+        };
+        if(boost::algorithm::any_of(vechyp, [&](SPoseHypothesis const& hypOther) {
+            return hyp.m_fScore <= hypOther.m_fScore && Near(hypOther);
+        })) {
+            return;
+        }
+        vechyp.erase(boost::remove_if(vechyp, Near), vechyp.end());
+        vechyp.insert(
+            std::upper_bound(vechyp.begin(), vechyp.end(), hyp, [](SPoseHypothesis const& lhs, SPoseHypothesis const& rhs) {
+                return lhs.m_fScore > rhs.m_fScore;
+            }),
+            hyp
+        );
+        if(cHypotheses < vechyp.size()) vechyp.pop_back();
+    }
+}
+
+rbt::pose<double> CorrelativeScanMatch(rbt::pose<double> const& poseWorld, SScanLine const& scanline, CCorrelativeTables const& tables) {
+    return CorrelativeScanMatch(poseWorld, scanline, tables, c_nCorrelativeSearchRadius, c_fCorrelativeSearchAngle, c_nCorrelativeLevels).m_pose;
+}
+
+SPoseHypothesis CorrelativeScanMatch(rbt::pose<double> const& poseWorld, SScanLine const& scanline, CCorrelativeTables const& tables, 
+    int nSearchRadius, double fSearchAngle, int cLevels
+) {
+    if(scanline.m_vecscan.empty()) return SPoseHypothesis{poseWorld, 0.0};
+
+    auto const fAngleStep = AngleStep(scanline);
+    int const cAngleSteps = static_cast<int>(std::ceil(rbt::rad(fSearchAngle) / fAngleStep));
+    std::vector<double> vecfYaw;
+    for(int i = -cAngleSteps; i <= cAngleSteps; ++i) {
+        vecfYaw.emplace_back(poseWorld.m_fYaw + i * fAngleStep);
+    }
+
+    SBranchAndBound const bnb(
+        scanline, poseWorld.m_pt, vecfYaw, 
+        rbt::rect<int>{-nSearchRadius, -nSearchRadius, nSearchRadius, nSearchRadius},
+        tables, cLevels
+    );
+
+    // Start with the unmodified pose, so the search only moves for a strictly better match
+    auto candBest = bnb.candidate(cAngleSteps, rbt::size<int>::zero(), 0);
+    int nScoreMin = candBest.m_nScore;
+
+    std::vector<SCandidate> veccand;
+    for(std::size_t iAngle = 0; iAngle < vecfYaw.size(); ++iAngle) {
+        bnb.candidates(iAngle, cLevels - 1, veccand);
+    }
+    bnb.search(veccand, nScoreMin, [&](SCandidate const& cand) {
+        candBest = cand;
+        nScoreMin = cand.m_nScore;
+    });
+
+    return SPoseHypothesis{
+        rbt::pose<double>(
+            poseWorld.m_pt + rbt::size<double>(candBest.m_szn) * c_nScale,
+            vecfYaw[candBest.m_iAngle]
+        ),
+        candBest.m_nScore / (255.0 * scanline.m_vecscan.size())
+    };
+}
+
+std::vector<SPoseHypothesis> GlobalRelocalization(SScanLine const& scanline, COccupancyGridWithObstacleList& occgrid, std::size_t cHypotheses) {
+    auto const rectnBounds = occgrid.Bounds();
+    if(scanline.m_vecscan.empty() || 0==cHypotheses || rectnBounds.right < rectnBounds.left) return {};
+    occgrid.UpdateCorrelativeTables(c_nRelocalizationLevels);
+
+    // Full circle of rotations around the world origin, translated to every mapped cell
+    int const cAngles = static_cast<int>(std::ceil(2*M_PI / AngleStep(scanline)));
+    std::vector<double> vecfYaw;
+    for(int i = 0; i < cAngles; ++i) {
+        vecfYaw.emplace_back(i * 2*M_PI / cAngles);
+    }
+    auto const ptnOrigin = ToGridCoordinate(rbt::point<double>::zero());
+    SBranchAndBound const bnb(
+        scanline, rbt::point<double>::zero(), vecfYaw,
+        rbt::rect<int>{
+            rectnBounds.left - ptnOrigin.x, rectnBounds.bottom - ptnOrigin.y,
+            rectnBounds.right - ptnOrigin.x, rectnBounds.top - ptnOrigin.y
+        },
+        occgrid.CorrelativeTables(), c_nRelocalizationLevels
+    );
+    auto const matnObstacle = occgrid.ObstacleMap(rectnBounds); // 255 is free
+
+    double const fScorePerfect = 255.0 * scanline.m_vecscan.size();
+    int const nScoreMinGlobal = static_cast<int>(c_fRelocalizationMinScore * fScorePerfect);
+
+    // Rotations are searched independently on the thread pool, each keeps its own hypotheses
+    std::vector<std::vector<SPoseHypothesis>> vecvechyp(vecfYaw.size());
+    ThreadPool().parallel_for(vecfYaw.size(), [&](std::size_t iAngle) {
+        auto& vechyp = vecvechyp[iAngle];
+        int nScoreMin = nScoreMinGlobal;
+
+        std::vector<SCandidate> veccand;
+        bnb.candidates(iAngle, c_nRelocalizationLevels - 1, veccand);
+        bnb.search(veccand, nScoreMin, [&](SCandidate const& cand) {
+            // The robot must stand in known free space
+            auto const ptn = ptnOrigin + cand.m_szn;
+            if(255!=matnObstacle.at<std::uint8_t>(ptn.y - rectnBounds.bottom, ptn.x - rectnBounds.left)) return;
+
+            AddHypothesis(
+                vechyp, 
+                SPoseHypothesis{
+                    rbt::pose<double>(rbt::point<double>::zero() + rbt::size<double>(cand.m_szn) * c_nScale, vecfYaw[iAngle]),
+                    cand.m_nScore / fScorePerfect
+                },
+                cHypotheses
+            );
+            if(cHypotheses==vechyp.size()) {
+                nScoreMin = std::max(nScoreMin, static_cast<int>(vechyp.back().m_fScore * fScorePerfect));
+            }
+        });
+    });
+
+    std::vector<SPoseHypothesis> vechyp;
+    boost::for_each(vecvechyp, [&](std::vector<SPoseHypothesis> const& vechypAngle) {
+        boost::for_each(vechypAngle, [&](SPoseHypothesis const& hyp) { AddHypothesis(vechyp, hyp, cHypotheses); });
+    });
+    return vechyp;
+}
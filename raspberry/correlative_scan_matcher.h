@@ -0,0 +1,75 @@
+#pragma once
+
+#include "geometry.h"
+#include "scanline.h"
+#include "tiled_grid.h"
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+
+struct CDistanceField;
+
+// Lookup tables of the correlative scan matcher for a whole map. Level 0 stores the score
+// of a scan point in every cell, computed from the distance field. Level n stores the maximum 
+// score of the 2^n x 2^n cells above and right of each cell. 
+//
+// The tables are stored in copy-on-write tiles like the map, so copies of a map share them.
+// The map invalidates the cells whose obstacle state changed, update() only recomputes
+// the tables around them instead of scoring and dilating the whole search window per match.
+struct CCorrelativeTables {
+    CCorrelativeTables();
+
+    int LevelCount() const { return static_cast<int>(m_vecgridnLevel.size()); }
+    // Marks the obstacle state of cell pt as changed, see CDistanceField::invalidate
+    void invalidate(rbt::point<int> const& pt) { m_rectnInvalid |= pt; }
+    // Brings cLevels tables up to date with distfield, which must be up to date itself.
+    // If more levels are needed than before, all tables are recomputed for the whole map.
+    void update(CDistanceField const& distfield, int cLevels);
+    // Copies the inclusive rectangle rectn of level nLevel to a cv::Mat with rectn.left, rectn.bottom at (0, 0)
+    cv::Mat ToMat(int nLevel, rbt::rect<int> const& rectn) const;
+
+private:
+    std::vector<CTiledGrid<std::uint8_t>> m_vecgridnLevel;
+    rbt::rect<int> m_rectnInvalid; // obstacle cells changed since the last update
+};
+
+// Correlative scan matcher, see Olson "Real-Time Correlative Scan Matching" (ICRA 2009)
+// and the branch and bound search in Hess et al "Real-Time Loop Closure in 2D LIDAR SLAM" (ICRA 2016).
+//
+// Searches the best pose in a window of +-c_nCorrelativeSearchRadius px and
+// +-c_fCorrelativeSearchAngle around poseWorld. Every scan point scores the likelihood
+// of the distance field cell it falls into. The search uses the lookup tables of
+// CCorrelativeTables, the sums of the maxima in level n are upper bounds for the score 
+// of all translations in a 2^n x 2^n region, so whole regions can be discarded without 
+// scoring each translation. tables must have at least c_nCorrelativeLevels levels.
+//
+// Unlike ICP, the matcher always finds the global optimum within the search window
+// and its runtime is bounded by the size of the window.
+rbt::pose<double> CorrelativeScanMatch(rbt::pose<double> const& poseWorld, SScanLine const& scanline, CCorrelativeTables const& tables);
+
+struct SPoseHypothesis {
+    rbt::pose<double> m_pose;
+    double m_fScore; // in [0, 1], 1 if every scan point lies on an obstacle
+};
+
+// Same search in a window of +-nSearchRadius px and +-fSearchAngle degrees with cLevels lookup 
+// tables, e.g., to close loops after the pose drifted further than c_nCorrelativeSearchRadius.
+// The coarsest lookup table should cover regions of about nSearchRadius px.
+SPoseHypothesis CorrelativeScanMatch(rbt::pose<double> const& poseWorld, SScanLine const& scanline, CCorrelativeTables const& tables, 
+    int nSearchRadius, double fSearchAngle, int cLevels);
+
+struct COccupancyGridWithObstacleList;
+
+// Global relocalization, e.g., after a restart or when the robot has been moved.
+// Searches all rotations and all positions within the bounds of occgrid, i.e., 
+// the whole mapped area, for the poses explaining scanline best. The same branch and bound search over 
+// c_nRelocalizationLevels lookup tables is run for every rotation in parallel on 
+// the thread pool. Brings the lookup tables of occgrid up to date with c_nRelocalizationLevels 
+// levels first. Only poses in known free space that reach c_fRelocalizationMinScore 
+// are considered. Returns up to cHypotheses hypotheses sorted by descending score,
+// any two of them are at least c_nRelocalizationSeparation px or 
+// c_fRelocalizationSeparationAngle degrees apart.
+//
+// scanline should be downsampled, the runtime grows with the number of scan points.
+std::vector<SPoseHypothesis> GlobalRelocalization(SScanLine const& scanline, COccupancyGridWithObstacleList& occgrid, std::size_t cHypotheses = 5);
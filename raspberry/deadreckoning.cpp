@@ -28,6 +28,6 @@ void CDeadReckoningMapping::receivedSensorData(SOdometryData const& odom) {
 //     m_occgrid.update(m_vecpose.back(), rbt::rad(data.m_nAngle), data.m_nDistance);    
 // }
 
-cv::Mat const& CDeadReckoningMapping::getMap() {
+cv::Mat CDeadReckoningMapping::getMap() {
     return m_occgrid.ObstacleMap();
 }
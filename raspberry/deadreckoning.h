@@ -14,7 +14,7 @@ struct CDeadReckoningMapping : rbt::nonmoveable {
     void receivedSensorData(SOdometryData const& odom);
     void receivedSensorData(SScanLine const& scanline);
 
-    cv::Mat const& getMap();
+    cv::Mat getMap();
 private:
     COccupancyGrid m_occgrid;
     std::vector<rbt::pose<double>> m_vecpose;
@@ -0,0 +1,59 @@
+#include "distance_field.h"
+#include "robot_configuration.h"
+
+#include <opencv2/imgproc.hpp>
+#include <vector>
+
+CDistanceField::CDistanceField()
+    : m_gridfDistance(c_nMaxObstacleDistance)
+    , m_gridoffsetNearest(SObstacleOffset::none())
+    , m_rectnInvalid(rbt::rect<int>::empty())
+{}
+
+void CDistanceField::update(CTiledGrid<std::uint8_t> const& gridnObstacle) {
+    if(m_rectnInvalid.right<m_rectnInvalid.left) return; // nothing changed
+
+    // Distances may change up to c_nMaxObstacleDistance around the invalidated cells.
+    // Their closest obstacle is at most c_nMaxObstacleDistance further away.
+    auto Inflate = [](rbt::rect<int> const& rectn, int nBorder) {
+        return rbt::rect<int>{rectn.left - nBorder, rectn.bottom - nBorder, rectn.right + nBorder, rectn.top + nBorder};
+    };
+    auto const rectnUpdate = Inflate(m_rectnInvalid, c_nMaxObstacleDistance);
+    auto const rectnWindow = Inflate(m_rectnInvalid, 2*c_nMaxObstacleDistance);
+
+    auto const matnObstacle = gridnObstacle.ToMat(rectnWindow);
+    cv::Mat matfDistance;
+    cv::Mat matnLabel;
+    cv::distanceTransform(matnObstacle, matfDistance, matnLabel, CV_DIST_L2, 3, cv::DIST_LABEL_PIXEL);
+
+    // DIST_LABEL_PIXEL numbers the obstacle pixels in row-major order starting at 1
+    std::vector<rbt::point<int>> vecptObstacle;
+    for(int y = 0; y < matnObstacle.rows; ++y) {
+        auto const* pn = matnObstacle.ptr<std::uint8_t>(y);
+        for(int x = 0; x < matnObstacle.cols; ++x) {
+            if(0==pn[x]) vecptObstacle.emplace_back(x + rectnWindow.left, y + rectnWindow.bottom);
+        }
+    }
+
+    for(int y = rectnUpdate.bottom; y <= rectnUpdate.top; ++y) {
+        auto const* pf = matfDistance.ptr<float>(y - rectnWindow.bottom) + (rectnUpdate.left - rectnWindow.left);
+        auto const* pnLabel = matnLabel.ptr<int>(y - rectnWindow.bottom) + (rectnUpdate.left - rectnWindow.left);
+        for(int x = rectnUpdate.left; x <= rectnUpdate.right; ++x, ++pf, ++pnLabel) {
+            rbt::point<int> const pt(x, y);
+            auto const fDistance = std::min(*pf, static_cast<float>(c_nMaxObstacleDistance));
+            // Don't copy shared tiles if nothing changes
+            if(fDistance!=m_gridfDistance.at(pt)) m_gridfDistance.ref(pt) = fDistance;
+
+            auto offset = SObstacleOffset::none();
+            if(fDistance<c_nMaxObstacleDistance && 0<*pnLabel) {
+                auto const sz = vecptObstacle[*pnLabel - 1] - pt;
+                // The labeled transform is approximate, make sure the offset fits
+                if(std::abs(sz.x)<=c_nMaxObstacleDistance + 1 && std::abs(sz.y)<=c_nMaxObstacleDistance + 1) {
+                    offset = SObstacleOffset{static_cast<std::int8_t>(sz.x), static_cast<std::int8_t>(sz.y)};
+                }
+            }
+            if(offset!=m_gridoffsetNearest.at(pt)) m_gridoffsetNearest.ref(pt) = offset;
+        }
+    }
+    m_rectnInvalid = rbt::rect<int>::empty();
+}
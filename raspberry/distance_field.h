@@ -0,0 +1,59 @@
+#pragma once
+
+#include "geometry.h"
+#include "tiled_grid.h"
+
+#include <cstdint>
+#include <limits>
+
+// Offset from a grid cell to its closest obstacle
+struct SObstacleOffset {
+    std::int8_t m_nX;
+    std::int8_t m_nY;
+
+    static SObstacleOffset none() { // no obstacle within c_nMaxObstacleDistance
+        return {std::numeric_limits<std::int8_t>::lowest(), std::numeric_limits<std::int8_t>::lowest()};
+    }
+    bool valid() const { return std::numeric_limits<std::int8_t>::lowest()!=m_nX; }
+    bool operator==(SObstacleOffset const& rhs) const { return m_nX==rhs.m_nX && m_nY==rhs.m_nY; }
+    bool operator!=(SObstacleOffset const& rhs) const { return !(*this==rhs); }
+};
+
+// Distance of every grid cell to the closest obstacle, i.e., the likelihood field
+// of Thrun et al, "Probabilistic Robotics" p 169ff. Distances are in grid cells and
+// clamped to c_nMaxObstacleDistance, so a changed obstacle cell only affects the
+// distances within c_nMaxObstacleDistance around it.
+//
+// Alongside the distances, the field stores the offset to the closest obstacle, so that
+// nearest neighbor queries within c_nMaxObstacleDistance are a single table lookup.
+//
+// The occupancy grids invalidate the cells whose obstacle state changed and update
+// the distance field once per scan. Only the invalidated region is recomputed.
+// Like the occupancy grid, the field is stored in copy-on-write tiles.
+struct CDistanceField {
+    CDistanceField();
+
+    // Distance to closest obstacle in grid cells, in [0, c_nMaxObstacleDistance]
+    float distance(rbt::point<int> const& pt) const { return m_gridfDistance.at(pt); }
+    cv::Mat ToMat(rbt::rect<int> const& rectn) const { return m_gridfDistance.ToMat(rectn); }
+    // Bounding rectangle of all cells that have been computed, see CTiledGrid::bounds
+    rbt::rect<int> bounds() const { return m_gridfDistance.bounds(); }
+    // Closest obstacle cell to pt, false if there is none within c_nMaxObstacleDistance
+    bool nearest(rbt::point<int> const& pt, rbt::point<int>& ptNearest) const {
+        auto const offset = m_gridoffsetNearest.at(pt);
+        if(!offset.valid()) return false;
+        ptNearest = pt + rbt::size<int>(offset.m_nX, offset.m_nY);
+        return true;
+    }
+
+    // Marks the obstacle state of cell pt as changed
+    void invalidate(rbt::point<int> const& pt) { m_rectnInvalid |= pt; }
+    // Recomputes the distances around all invalidated cells from the obstacle map
+    // gridnObstacle, in which obstacles are 0.
+    void update(CTiledGrid<std::uint8_t> const& gridnObstacle);
+
+private:
+    CTiledGrid<float> m_gridfDistance;
+    CTiledGrid<SObstacleOffset> m_gridoffsetNearest;
+    rbt::rect<int> m_rectnInvalid;
+};
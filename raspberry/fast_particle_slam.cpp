@@ -2,104 +2,194 @@
 #include "robot_configuration.h"
 #include "error_handling.h"
 #include "occupancy_grid.inl"
+#include "map_snapshot.h"
+#include "thread_pool.h"
+#include "random_generator.h"
+#include "particle_weights.h"
+#include "correlative_scan_matcher.h"
 
 #include <boost/range/algorithm/max_element.hpp>
-#include <boost/range/adaptor/transformed.hpp>
+#include <boost/range/algorithm/find.hpp>
+#include <boost/range/algorithm/sort.hpp>
 
 #include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <iostream>
+#include <iterator>
 #include <random>
-#include <future>
+#include <type_traits>
 
 // Based on Grisetti, Stachniss, Burgard 
 // "Improving Grid-based SLAM with Rao-Blackwellized Particle Filters by Adaptive Proposals and Selective Resampling"
 // and their implementation at https://openslam.org/gmapping.html
-SFastSlamParticle::SFastSlamParticle() : m_pose(rbt::pose<double>::zero()) {}
+SFastSlamParticle::SFastSlamParticle() : m_escanmatcher(escanmatcherICP_LOOKUP) {}
 
-void SFastSlamParticle::updatePose(SScanLine const& scanline) {
+rbt::pose<double> SFastSlamParticle::updatePose(rbt::pose<double> const& pose, SScanLine const& scanline, double& fLogWeight) {
     // 1. Update particles with probabilistic motion model
-    auto poseSampled = sample_motion_model(m_pose, scanline.translation(), scanline.rotation());
+    auto poseSampled = sample_motion_model(pose, scanline.translation(), scanline.rotation());
 
     // 2. If not first update (and optionally: enough distance traveled since last update)
     //    scan match and update particle pose
-    m_pose = m_occgrid.fit(poseSampled, scanline);
+    auto const poseMatched = m_occgrid.fit(poseSampled, scanline, m_escanmatcher);
     
     // 3. Compute likelihood of resulting match
-    // gmapping computes log likelihood, also skips distanceTransform and searches
-    // in small kernel around expected obstacle
-    m_fLogWeight += log_likelihood_field(m_pose, scanline, m_occgrid);
+    // gmapping computes log likelihood and searches in small kernel around expected obstacle,
+    // we look up the distance in the incrementally updated distance field instead
+    fLogWeight += log_likelihood_field(poseMatched, scanline, m_occgrid.DistanceField());
     
-    LOG("Update Particle: poseSampled = " << poseSampled << " m_pose = " << m_pose << " m_fLogWeight = " << m_fLogWeight << "\n");
+    LOG("Update Particle: poseSampled = " << poseSampled << " poseMatched = " << poseMatched << " fLogWeight = " << fLogWeight << "\n");
+    return poseMatched;
 }
 
-void SFastSlamParticle::updateMap(SScanLine const& scanline) {
-    boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
-        m_occgrid.update(m_pose, scan.m_fRadAngle, scan.m_nDistance);
+void SFastSlamParticle::updateMap(rbt::pose<double> const& pose, SScanLine const& scanline) {
+    m_occgrid.ClearDirtyRect();
+    m_occgrid.update(pose, scanline);
+    m_occgrid.UpdateDistanceField();
+}
+
+CFastParticleSlamBase::CFastParticleSlamBase(int cParticlesMin, int cParticlesMax, EScanMatcher escanmatcher, bool bPipelined) 
+    : m_cParticlesMin(cParticlesMin), m_cParticlesMax(cParticlesMax)
+    , m_vecposeParticle(cParticlesMin, rbt::pose<double>::zero())
+    , m_vecfLogWeight(cParticlesMin, 0.0)
+    , m_vecfWeight(cParticlesMin, 1.0/cParticlesMin)
+    , m_vecparticle(cParticlesMin), m_iparticleBest(0)
+    , m_matnMap(m_vecparticle.front().m_occgrid.ObstacleMap())
+    , m_iparticleMap(0)
+    , m_fNEff(1.0)
+    , m_bRelocalize(false)
+    , m_bPipelined(bPipelined)
+{
+    ASSERT(0<cParticlesMin && cParticlesMin<=cParticlesMax);
+    boost::for_each(m_vecparticle, [&](SFastSlamParticle& p) { p.m_escanmatcher = escanmatcher; });
+}
+
+std::size_t CFastParticleSlamBase::KLDParticleCount() const {
+    if(m_cParticlesMin==m_cParticlesMax) return m_cParticlesMin;
+
+    // Fox "Adapting the Sample Size in Particle Filters Through KLD-Sampling", IJRR 2003
+    // The particles have been sampled from the proposal distribution, count the 
+    // histogram bins they occupy
+    std::vector<std::array<int, 3>> vecanBin;
+    boost::for_each(m_vecposeParticle, [&](rbt::pose<double> const& pose) {
+        vecanBin.push_back({{
+            static_cast<int>(std::floor(pose.m_pt.x / c_nKLDBinSize)),
+            static_cast<int>(std::floor(pose.m_pt.y / c_nKLDBinSize)),
+            static_cast<int>(std::floor(std::remainder(pose.m_fYaw, 2*M_PI) / rbt::rad(c_fKLDBinAngle)))
+        }});
     });
+    boost::sort(vecanBin);
+    auto const cBins = std::distance(vecanBin.begin(), std::unique(vecanBin.begin(), vecanBin.end()));
+    if(cBins<2) return m_cParticlesMin;
+
+    // Number of samples needed so that the K-L distance between the sample based 
+    // approximation and the true posterior is below c_fKLDEpsilon, Wilson-Hilferty 
+    // approximation of the chi-square quantile with cBins-1 degrees of freedom
+    auto const fK = static_cast<double>(cBins - 1);
+    auto const f = 2 / (9 * fK);
+    auto const fCount = fK / (2 * c_fKLDEpsilon) * std::pow(1 - f + std::sqrt(f) * c_fKLDQuantile, 3);
+    return std::max(m_cParticlesMin, std::min(m_cParticlesMax, static_cast<std::size_t>(std::ceil(fCount))));
 }
 
-CFastParticleSlamBase::CFastParticleSlamBase(int cParticles) 
-    : m_vecparticle(cParticles), m_itparticleBest(m_vecparticle.begin()), m_fNEff(1.0)
-{}
+bool CFastParticleSlamBase::receivedSensorData(SScanLine const& scanlineSensor) {
+    // The first scan line initializes the map
+    SScanLine scanline;
+    if(!m_odomacc.add(scanlineSensor, /*bForce*/ m_vecpose.empty() || m_bRelocalize, scanline)) return false;
 
-static std::random_device s_rd;
-void CFastParticleSlamBase::receivedSensorData(SScanLine const& scanline) {
      LOG("=== Update === ");
      LOG("t = " << scanline.translation() << " phi = " << scanline.rotation());
     
-    {
-        std::vector<std::future<void>> vecfuture;
-        boost::for_each(m_vecparticle, [&](auto& p) {
-            vecfuture.emplace_back( 
-                std::async(std::launch::async,
-                    [&] {
-                        p.updatePose(scanline);
-                    }
-                ));
-        });
-    }
+    // Scan matching needs the maps of the previous scan line
+    waitForMapUpdate();
+    if(m_bRelocalize) relocalize(scanline);
+
+    // Match and score a downsampled scan line, update the maps with all scans
+    auto const scanlineMatch = scanline.downsampled();
+    ThreadPool().parallel_for(m_vecparticle.size(), [&](std::size_t i) {
+        SeedRandomGenerator(m_vecpose.size(), i);
+        m_vecposeParticle[i] = m_vecparticle[i].updatePose(m_vecposeParticle[i], scanlineMatch, m_vecfLogWeight[i]);
+    });
 
     // 4. Normalize weights (see GridSlamProcessor::normalize())
-    {
-        // TODO: m_obsSigmaGain
-        double const fGain = 1. / ( 3 * /* = m_obsSigmaGain */ m_vecparticle.size());
-        auto const fMax = *boost::max_element(boost::adaptors::transform(m_vecparticle, std::mem_fn(&SFastSlamParticle::m_fLogWeight)));
-        
-        double fWeightSum = 0;
-        boost::for_each(m_vecparticle, [&](auto& p) {
-            p.m_fWeight = std::exp(fGain * (p.m_fLogWeight - fMax));
-            fWeightSum += p.m_fWeight;
-        });
-        
-        m_fNEff = 0;
-        boost::for_each(m_vecparticle, [&](auto& p) {
-            p.m_fWeight /= fWeightSum;
-            m_fNEff += p.m_fWeight*p.m_fWeight;
-        });
-        m_fNEff = 1.0 / m_fNEff;
+    // TODO: m_obsSigmaGain
+    m_fNEff = NormalizeLogWeights(m_vecfLogWeight, 1. / ( 3 * /* = m_obsSigmaGain */ m_vecparticle.size()), m_vecfWeight);
+
+    // 5. If neff < threshold or the particle count should adapt, resample
+    // Only resample for a significant change of the count, every resampling step 
+    // risks losing particle diversity.
+    auto const cParticles = KLDParticleCount();
+    std::vector<int> veciparticle; // indices of the resampled particles, empty if not resampling
+    if(m_fNEff<0.5 * m_vecparticle.size() || 2*cParticles<=m_vecparticle.size() || 2*m_vecparticle.size()<=cParticles) {
+        LOG("============ Resample " << m_vecparticle.size() << " -> " << cParticles << " particles ============");
+        // Key differs from all particle tasks, the thread may have run any of them
+        SeedRandomGenerator(m_vecpose.size(), m_vecparticle.size());
+        veciparticle = SystematicResample(
+            m_vecfWeight, 
+            cParticles, 
+            std::uniform_real_distribution<double>(0.0, 1.0)(RandomGenerator())
+        );
+
+        // Resample poses and weights right away, the maps follow in updateMaps
+        auto Permuted = [&](auto const& vect) {
+            std::decay_t<decltype(vect)> vectPermuted;
+            vectPermuted.reserve(veciparticle.size());
+            boost::for_each(veciparticle, [&](int i) { vectPermuted.emplace_back(vect[i]); });
+            return vectPermuted;
+        };
+        m_vecposeParticle = Permuted(m_vecposeParticle);
+        m_vecfWeight = Permuted(m_vecfWeight);
+        m_vecfLogWeight.assign(veciparticle.size(), 0.0);
+    }
+    
+    // Copies keep the weights, so the best particle is the same after resampling
+    m_iparticleBest = std::distance(m_vecfWeight.begin(), boost::max_element(m_vecfWeight));
+    m_vecpose.emplace_back(m_vecposeParticle[m_iparticleBest]);
+
+    if(m_bPipelined) {
+        m_workerMapUpdate.run([this, scanline, veciparticle] { updateMaps(scanline, veciparticle); });
+    } else {
+        updateMaps(scanline, veciparticle);
     }
+    return true;
+}
 
-    // 5. If neff < threshold, resample
-    if(m_fNEff<0.5 * m_vecparticle.size()) {
-        LOG("============ Resample ============");
-        // Resampling
-        // Thrun, Probabilistic robotics, p. 110
-        auto const fStepSize = 1.0/m_vecparticle.size();
-        auto const r = std::uniform_real_distribution<double>(0.0, fStepSize)(s_rd);
-        auto c = m_vecparticle.front().m_fWeight;
-
-        std::vector<int> veciparticle;
-        for(int i = 0, m = 0; m<m_vecparticle.size(); ++m) {
-            auto const u = r + m * fStepSize;
-            while(c<u) {
-                ++i;
-                c += m_vecparticle[i].m_fWeight;
-            }
-            veciparticle.emplace_back(i);
-            LOG("Keep particle " << i);
+void CFastParticleSlamBase::waitForMapUpdate() const {
+    m_workerMapUpdate.wait();
+}
+
+void CFastParticleSlamBase::relocalize(SScanLine& scanline) {
+    m_bRelocalize = false;
+    auto const vechyp = GlobalRelocalization(scanline.downsampled(), m_vecparticle[m_iparticleBest].m_occgrid, 1);
+    if(vechyp.empty()) {
+        LOG("Relocalization failed, continuing from the saved pose");
+        return;
+    }
+    LOG("Relocalized at " << vechyp.front().m_pose << " score = " << vechyp.front().m_fScore);
+    std::fill(m_vecposeParticle.begin(), m_vecposeParticle.end(), vechyp.front().m_pose);
+    scanline.m_pose = rbt::pose<double>::zero();
+}
+
+void CFastParticleSlamBase::updateMaps(SScanLine const& scanline, std::vector<int> const& veciparticle) {
+    if(veciparticle.empty()) {
+        ThreadPool().parallel_for(m_vecparticle.size(), [&](std::size_t i) {
+            m_vecparticle[i].updateMap(m_vecposeParticle[i], scanline);
+        });
+    } else {
+        // Integrate the scan line once into every particle surviving resampling and 
+        // copy it afterwards. The copies share the updated tiles instead of integrating
+        // the same scan line at the same pose and cloning the same tiles each.
+        // veciparticle is sorted, particles that did not survive are never updated.
+        std::vector<std::size_t> veciFirstCopy;
+        for(std::size_t i = 0; i < veciparticle.size(); ++i) {
+            if(0==i || veciparticle[i-1]!=veciparticle[i]) veciFirstCopy.emplace_back(i);
         }
-        
-        std::vector<SFastSlamParticle> vecparticle(m_vecparticle.size());
+        ThreadPool().parallel_for(veciFirstCopy.size(), [&](std::size_t i) {
+            auto const iCopy = veciFirstCopy[i];
+            m_vecparticle[veciparticle[iCopy]].updateMap(m_vecposeParticle[iCopy], scanline);
+        });
+
+        std::vector<SFastSlamParticle> vecparticle(veciparticle.size());
         auto itparticleOut = vecparticle.begin();
         for(auto itn = veciparticle.begin(); itn!=veciparticle.end(); ++itn) {
             if(boost::next(itn)==veciparticle.end() || *itn!=*boost::next(itn)) {
@@ -107,45 +197,77 @@ void CFastParticleSlamBase::receivedSensorData(SScanLine const& scanline) {
             } else {
                 *itparticleOut = m_vecparticle[*itn];
             }
-            itparticleOut->m_fLogWeight = 0.0;
             ++itparticleOut;
         }
         std::swap(m_vecparticle, vecparticle);
+
+        // Any copy of the rendered particle can be updated incrementally
+        auto const itn = boost::find(veciparticle, m_iparticleMap);
+        m_iparticleMap = veciparticle.end()!=itn 
+            ? std::distance(veciparticle.begin(), itn) 
+            : m_vecparticle.size();
     }
-    
-    m_itparticleBest = boost::max_element(
-        boost::adaptors::transform(m_vecparticle, std::mem_fn(&SFastSlamParticle::m_fWeight))
-    ).base();
-    m_vecpose.emplace_back(m_itparticleBest->m_pose);
-
-    {
-        std::vector<std::future<void>> vecfuture;
-        boost::for_each(m_vecparticle, [&](auto& p) {
-            vecfuture.emplace_back( 
-                std::async(std::launch::async,
-                    [&] {
-                        p.updateMap(scanline);
-                    }
-                ));
-        });
+
+    auto const& occgridBest = m_vecparticle[m_iparticleBest].m_occgrid;
+    if(m_iparticleBest==m_iparticleMap) {
+        occgridBest.UpdateObstacleMap(m_matnMap, c_rectnMapWindow);
+    } else {
+        m_matnMap = occgridBest.ObstacleMap();
+        m_iparticleMap = m_iparticleBest;
     }
 }
 
 cv::Mat CFastParticleSlamBase::getMapWithPoses() const {
-    ASSERT(m_itparticleBest!=m_vecparticle.end());
-    return m_itparticleBest->m_occgrid.ObstacleMapWithPoses(m_vecpose);
+    waitForMapUpdate();
+    ASSERT(m_iparticleBest<m_vecparticle.size());
+    return ObstacleMapWithPoses(m_matnMap.clone(), m_vecpose);
 }
 
 cv::Mat CFastParticleSlamBase::getMap() const {
-    ASSERT(m_itparticleBest!=m_vecparticle.end());
-    return m_itparticleBest->m_occgrid.ObstacleMap();
+    waitForMapUpdate();
+    ASSERT(m_iparticleBest<m_vecparticle.size());
+    return m_matnMap.clone(); // callers draw into the map
+}
+
+bool CFastParticleSlamBase::SaveMap(std::string const& strFile) const {
+    waitForMapUpdate();
+    ASSERT(m_iparticleBest<m_vecparticle.size());
+    return SaveMapSnapshot(strFile, m_vecparticle[m_iparticleBest].m_occgrid, m_vecpose);
+}
+
+bool CFastParticleSlamBase::LoadMap(std::string const& strFile, bool bRelocalize) {
+    waitForMapUpdate();
+    SFastSlamParticle particle;
+    std::vector<rbt::pose<double>> vecpose;
+    if(!LoadMapSnapshot(strFile, particle.m_occgrid, vecpose)) return false;
+    
+    particle.m_escanmatcher = m_vecparticle.front().m_escanmatcher;
+    // Particles share all map tiles until they diverge
+    std::fill(m_vecparticle.begin(), m_vecparticle.end(), particle); 
+    std::fill(m_vecposeParticle.begin(), m_vecposeParticle.end(), vecpose.empty() ? rbt::pose<double>::zero() : vecpose.back());
+    std::fill(m_vecfLogWeight.begin(), m_vecfLogWeight.end(), 0.0);
+    std::fill(m_vecfWeight.begin(), m_vecfWeight.end(), 1.0/m_vecparticle.size());
+    m_iparticleBest = 0;
+    m_vecpose = std::move(vecpose);
+    m_odomacc = SOdometryAccumulator();
+    m_bRelocalize = bRelocalize;
+
+    m_matnMap = m_vecparticle[m_iparticleBest].m_occgrid.ObstacleMap();
+    m_iparticleMap = 0;
+    return true;
+}
+
+std::vector<cv::Mat> CFastParticleSlamBase::getMapPyramid() {
+    waitForMapUpdate();
+    ASSERT(m_iparticleBest<m_vecparticle.size());
+    return m_vecparticle[m_iparticleBest].m_occgrid.ObstacleMapPyramid(c_rectnMapWindow);
 }
 
 cv::Mat CFastParticleSlamBase::getMapWithPose() const {
-    ASSERT(m_itparticleBest!=m_vecparticle.end());
-    cv::Mat mat = m_itparticleBest->m_occgrid.ObstacleMap();
+    waitForMapUpdate();
+    ASSERT(m_iparticleBest<m_vecparticle.size());
     cv::Mat matColor;
-    cvtColor(mat, matColor, CV_GRAY2RGB);
+    cvtColor(m_matnMap, matColor, CV_GRAY2RGB);
     RenderRobotPose(matColor, m_vecpose.back(), cv::Scalar(255, 0, 0));
     return matColor;
 }
@@ -7,35 +7,87 @@
 #include <opencv2/core.hpp>
 #include "scanline.h"
 #include "scanmatching.h"
+#include "thread_pool.h"
 
 // Simple particle filter algorithm as described 
 // in Thrun et al "Probabilistic Robotics" p 478
+//
+// Map and scan matcher of a particle. The poses and weights of all particles are 
+// stored in contiguous arrays in CFastParticleSlamBase, so normalizing the weights 
+// and resampling never touch the maps.
 struct SFastSlamParticle {
-    rbt::pose<double> m_pose;    
-    double m_fLogWeight;
-    double m_fWeight;
-    
+    // Shares all unmodified tiles with the particles of the same lineage, see CTileDirectory
     COccupancyGridWithObstacleList m_occgrid;
+    EScanMatcher m_escanmatcher;
     
     SFastSlamParticle();
-    void updatePose(SScanLine const& scanline);
-    void updateMap(SScanLine const& scanline);
+    // Samples the motion model and matches scanline against the map. 
+    // Returns the new pose and adds the log likelihood of the match to fLogWeight.
+    rbt::pose<double> updatePose(rbt::pose<double> const& pose, SScanLine const& scanline, double& fLogWeight);
+    void updateMap(rbt::pose<double> const& pose, SScanLine const& scanline);
 };
 
 struct CFastParticleSlamBase : rbt::nonmoveable {
-    CFastParticleSlamBase(int cParticles = 10);
-    void receivedSensorData(SScanLine const& scanline);
+    // In pipelined mode, receivedSensorData returns as soon as the new pose has been 
+    // estimated and integrates the scan line into the particles' maps in the background.
+    // The next call to receivedSensorData and all map accessors wait for the integration.
+    //
+    // The particle count adapts between cParticlesMin and cParticlesMax by KLD-sampling:
+    // When resampling, the count is chosen from the number of histogram bins occupied by 
+    // the particle poses, i.e., few particles are used while the poses agree. 
+    // cParticlesMin==cParticlesMax uses a fixed count.
+    CFastParticleSlamBase(int cParticlesMin = 10, int cParticlesMax = 10, EScanMatcher escanmatcher = escanmatcherICP_LOOKUP, bool bPipelined = false);
+    // Processes scanline if the robot moved by c_fUpdateDistance or turned by c_fUpdateAngle
+    // since the last processed scan line and returns true. Otherwise only accumulates the 
+    // odometry into the next processed scan line and returns false.
+    bool receivedSensorData(SScanLine const& scanline);
     cv::Mat getMapWithPoses() const;
     cv::Mat getMapWithPose() const;
     cv::Mat getMap() const;
+    // Obstacle map of the best particle at all pyramid levels, pooled when requested
+    std::vector<cv::Mat> getMapPyramid();
 
     std::vector<rbt::pose<double>> const& Poses() const { return m_vecpose; } 
 
+    // Saves the best particle's map and the pose history, see map_snapshot.h
+    bool SaveMap(std::string const& strFile) const;
+    // Starts from a saved map. All particles share the loaded map and continue
+    // from the last saved pose, i.e., the robot must be where the snapshot was taken.
+    // If bRelocalize, the particles start at the pose found by GlobalRelocalization 
+    // with the next scan line instead, i.e., the robot may be anywhere on the map.
+    bool LoadMap(std::string const& strFile, bool bRelocalize = false);
+
 private:
+    // Integrates scanline into the particles' maps. If veciparticle is not empty,
+    // the maps are resampled like the poses, i.e., map i becomes a copy of map veciparticle[i].
+    void updateMaps(SScanLine const& scanline, std::vector<int> const& veciparticle);
+    void waitForMapUpdate() const;
+    // Moves all particles to the best pose found by GlobalRelocalization. 
+    // Clears the odometry of scanline, which is relative to the unknown previous pose.
+    void relocalize(SScanLine& scanline);
+    std::size_t KLDParticleCount() const;
+
+    std::size_t m_cParticlesMin;
+    std::size_t m_cParticlesMax;
+    // Particle set as structure of arrays
+    std::vector<rbt::pose<double>> m_vecposeParticle;
+    std::vector<double> m_vecfLogWeight;
+    std::vector<double> m_vecfWeight; // normalized
     std::vector<SFastSlamParticle> m_vecparticle;
-    std::vector<SFastSlamParticle>::const_iterator m_itparticleBest;
+    std::size_t m_iparticleBest;
+
+    // Obstacle map of c_rectnMapWindow, updated incrementally from the 
+    // dirty rectangle as long as the best particle's map is a descendant 
+    // of the map rendered previously
+    cv::Mat m_matnMap;
+    std::size_t m_iparticleMap; // index of particle rendered in m_matnMap
     
     double m_fNEff;
+    SOdometryAccumulator m_odomacc;
+    bool m_bRelocalize; // relocalize with the next scan line
     
     std::vector<rbt::pose<double>> m_vecpose; // history of best poses
+
+    bool m_bPipelined;
+    CBackgroundWorker m_workerMapUpdate; // declared last, destructor waits for the update
 }; 
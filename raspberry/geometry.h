@@ -338,4 +338,32 @@ namespace rbt {
         end = std::max(end, t);
         return *this;
     }
+
+    // Calls fn for every point on the 8-connected Bresenham line from ptA to ptB,
+    // including both end points. Equivalent to cv::LineIterator, but not clipped
+    // to image boundaries.
+    template<typename Func>
+    void for_each_line_point(point<int> const& ptA, point<int> const& ptB, Func fn) {
+        auto const nDeltaX = std::abs(ptB.x - ptA.x);
+        auto const nDeltaY = -std::abs(ptB.y - ptA.y);
+        auto const nStepX = ptA.x < ptB.x ? 1 : -1;
+        auto const nStepY = ptA.y < ptB.y ? 1 : -1;
+
+        auto pt = ptA;
+        auto nError = nDeltaX + nDeltaY;
+        while(true) {
+            fn(pt);
+            if(pt==ptB) break;
+
+            auto const nError2 = 2*nError;
+            if(nDeltaY <= nError2) {
+                nError += nDeltaY;
+                pt.x += nStepX;
+            }
+            if(nError2 <= nDeltaX) {
+                nError += nDeltaX;
+                pt.y += nStepY;
+            }
+        }
+    }
 }
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "geometry.h"
+
+#include <algorithm>
+#include <opencv2/core.hpp>
+
+// Coarse map levels for the coarse-to-fine search in FindPath. The pyramid is pooled from a
+// rendered obstacle map when a path is requested, see ObstacleMapPyramid. Scan matching and
+// relocalization search coarse to fine on the max-pooled lookup tables in CCorrelativeTables instead.
+int constexpr c_nPyramidLevels = 3; // 10, 20 and 40 cm per px
+
+// Cell at pyramid level nLevel containing cell pt of level 0. Level n has cells 2^n times
+// as large as level 0, the coarse cell (x, y) covers the cells (2x, 2y) to (2x+1, 2y+1) below it.
+inline rbt::point<int> PyramidLevelCoordinate(rbt::point<int> const& pt, int nLevel) {
+    auto FloorDiv = [&](int n) { return n<0 ? (n+1)/(1<<nLevel) - 1 : n/(1<<nLevel); };
+    return rbt::point<int>(FloorDiv(pt.x), FloorDiv(pt.y));
+}
+
+// Min-pools matn 2x2 to build an image pyramid from a map image. For an obstacle map, in
+// which occupied cells are 0 and unknown cells are 128, a coarse cell is only free if all
+// cells it covers are free. Odd rows and columns are padded with tDefault.
+template<typename T>
+cv::Mat MinPool2x2(cv::Mat const& mat, T tDefault) {
+    cv::Mat matPooled((mat.rows + 1)/2, (mat.cols + 1)/2, cv::DataType<T>::type);
+    auto At = [&](int x, int y) {
+        return x<mat.cols && y<mat.rows ? mat.at<T>(y, x) : tDefault;
+    };
+    for(int y = 0; y<matPooled.rows; ++y) {
+        for(int x = 0; x<matPooled.cols; ++x) {
+            matPooled.at<T>(y, x) = std::min(
+                std::min(At(2*x, 2*y), At(2*x+1, 2*y)),
+                std::min(At(2*x, 2*y+1), At(2*x+1, 2*y+1))
+            );
+        }
+    }
+    return matPooled;
+}
@@ -49,6 +49,14 @@ Icp::Icp (double const* M,const int32_t M_num,const int32_t dim) :
   M_tree = new kdtree::KDTree(M_data);
 }
 
+Icp::Icp (const int32_t dim) :
+  M_tree(0), dim(dim), max_iter(200), min_delta(1e-4) {
+  
+  // check for correct dimensionality
+  if (dim!=2 && dim!=3)
+    cout << "ERROR: LIBICP works only for data of dimensionality 2 or 3" << endl;
+}
+
 Icp::~Icp () {
   if (M_tree)
     delete M_tree;
@@ -56,8 +64,8 @@ Icp::~Icp () {
 
 void Icp::fit (double *T,const int32_t T_num,Matrix &R,Matrix &t,const double indist) {
   
-  // make sure we have a model tree
-  if (!M_tree) {
+  // make sure we have a model
+  if (!hasModel()) {
     cout << "ERROR: No model available." << endl;
     return;
   }
@@ -93,3 +101,12 @@ void Icp::fitIterate(double *T,const int32_t T_num,Matrix &R,Matrix &t,const std
     if (fitStep(T,T_num,R,t,active)<min_delta)
       break;
 }
+
+double Icp::nearestNeighbor (const float *query,float *nearest) const {
+  std::vector<float>         q(query,query+dim);
+  kdtree::KDTreeResultVector result;
+  M_tree->n_nearest(q,1,result);
+  for (int32_t n=0; n<dim; n++)
+    nearest[n] = M_tree->the_data[result[0].idx][n];
+  return result[0].dis;
+}
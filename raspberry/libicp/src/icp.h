@@ -70,6 +70,19 @@ private:
   
 protected:
   
+  // constructor for inherited classes that keep their own model and overwrite
+  // hasModel() and nearestNeighbor(), no kd tree is built
+  Icp (const int32_t dim);
+
+  // true if a model is available for fitting
+  virtual bool hasModel () const { return M_tree!=0; }
+
+  // nearest model point to query, must be thread-safe (called from openMP loops)
+  // input:  query ..... pointer to dim coordinates
+  // output: nearest ... dim coordinates of the nearest model point
+  // return: squared distance between query and nearest
+  virtual double nearestNeighbor (const float *query,float *nearest) const;
+
   // kd tree of model points
   kdtree::KDTree*     M_tree;
   kdtree::KDTreeArray M_data;
@@ -70,9 +70,10 @@ double IcpPointToPlane::fitStep (double *T,const int32_t T_num,Matrix &R,Matrix
     // establish correspondences
 #pragma omp parallel for private(i) default(none) shared(T,active,nact,p_m,p_t,A,b,r00,r01,r10,r11,t0,t1) // schedule (dynamic,2)
     for (i=0; i<nact; i++) {
-      // kd tree query + result
-      std::vector<float>         query(dim);
-      kdtree::KDTreeResultVector result;
+      // query + nearest model point + its normal
+      float query[3];
+      float nearest[3];
+      float normal[3];
 
       // get index of active point
       int32_t idx = active[i];
@@ -82,15 +83,15 @@ double IcpPointToPlane::fitStep (double *T,const int32_t T_num,Matrix &R,Matrix
       query[1] = (float)(r10*T[idx*2+0] + r11*T[idx*2+1] + t1);
 
       // search nearest neighbor
-      M_tree->n_nearest(query,1,result);
+      nearestNeighborWithNormal(query,nearest,normal);
 
       // model point
-      double dx = M_tree->the_data[result[0].idx][0];
-      double dy = M_tree->the_data[result[0].idx][1];
+      double dx = nearest[0];
+      double dy = nearest[1];
 
       // model point normal
-      double nx = M_normal[result[0].idx*2+0];
-      double ny = M_normal[result[0].idx*2+1];
+      double nx = normal[0];
+      double ny = normal[1];
 
       // template point
       double sx = query[0];
@@ -158,9 +159,10 @@ double IcpPointToPlane::fitStep (double *T,const int32_t T_num,Matrix &R,Matrix
     // establish correspondences
 #pragma omp parallel for private(i) default(none) shared(T,active,nact,p_m,p_t,A,b,r00,r01,r02,r10,r11,r12,r20,r21,r22,t0,t1,t2) // schedule (dynamic,2)
     for (i=0; i<nact; i++) {
-      // kd tree query + result
-      std::vector<float>         query(dim);
-      kdtree::KDTreeResultVector result;
+      // query + nearest model point + its normal
+      float query[3];
+      float nearest[3];
+      float normal[3];
 
       // get index of active point
       int32_t idx = active[i];
@@ -171,18 +173,17 @@ double IcpPointToPlane::fitStep (double *T,const int32_t T_num,Matrix &R,Matrix
       query[2] = (float)(r20*T[idx*3+0] + r21*T[idx*3+1] + r22*T[idx*3+2] + t2);
 
       // search nearest neighbor
-      M_tree->n_nearest(query,1,result);
-      //assert(result.size()!=0); // check if NN search failed
+      nearestNeighborWithNormal(query,nearest,normal);
 
       // model point
-      double dx = M_tree->the_data[result[0].idx][0];
-      double dy = M_tree->the_data[result[0].idx][1];
-      double dz = M_tree->the_data[result[0].idx][2];
+      double dx = nearest[0];
+      double dy = nearest[1];
+      double dz = nearest[2];
 
       // model point normal
-      double nx = M_normal[result[0].idx*3+0];
-      double ny = M_normal[result[0].idx*3+1];
-      double nz = M_normal[result[0].idx*3+2];
+      double nx = normal[0];
+      double ny = normal[1];
+      double nz = normal[2];
 
       // template point
       double sx = query[0];
@@ -252,8 +253,9 @@ std::vector<int32_t> IcpPointToPlane::getInliers (double *T,const int32_t T_num,
   
    // init inlier vector + query point + query result
   vector<int32_t>            inliers;
-  std::vector<float>         query(dim);
-  kdtree::KDTreeResultVector neighbor;
+  float                      query[3];
+  float                      nearest[3];
+  float                      normal[3];
   
   // dimensionality 2
   if (dim==2) {
@@ -271,16 +273,15 @@ std::vector<int32_t> IcpPointToPlane::getInliers (double *T,const int32_t T_num,
       double sy = r10*T[i*2+0] + r11*T[i*2+1] + t1; query[1] = (float)sy;
 
       // search nearest neighbor
-      M_tree->n_nearest(query,1,neighbor);
-      //assert(result.size()!=0); // check if NN search failed
+      nearestNeighborWithNormal(query,nearest,normal);
 
       // model point
-      double dx = M_tree->the_data[neighbor[0].idx][0];
-      double dy = M_tree->the_data[neighbor[0].idx][1];
+      double dx = nearest[0];
+      double dy = nearest[1];
 
       // model point normal
-      double nx = M_normal[neighbor[0].idx*2+0];
-      double ny = M_normal[neighbor[0].idx*2+1];
+      double nx = normal[0];
+      double ny = normal[1];
 
       // check if it is an inlier
       if ((sx-dx)*nx+(sy-dy)*ny<indist)
@@ -305,17 +306,17 @@ std::vector<int32_t> IcpPointToPlane::getInliers (double *T,const int32_t T_num,
       double sz = r20*T[i*3+0] + r21*T[i*3+1] + r22*T[i*3+2] + t2; query[2] = (float)sz;
 
       // search nearest neighbor
-      M_tree->n_nearest(query,1,neighbor);
+      nearestNeighborWithNormal(query,nearest,normal);
 
       // model point
-      double dx = M_tree->the_data[neighbor[0].idx][0];
-      double dy = M_tree->the_data[neighbor[0].idx][1];
-      double dz = M_tree->the_data[neighbor[0].idx][2];
+      double dx = nearest[0];
+      double dy = nearest[1];
+      double dz = nearest[2];
 
       // model point normal
-      double nx = M_normal[neighbor[0].idx*3+0];
-      double ny = M_normal[neighbor[0].idx*3+1];
-      double nz = M_normal[neighbor[0].idx*3+2];
+      double nx = normal[0];
+      double ny = normal[1];
+      double nz = normal[2];
 
       // check if it is an inlier
       if ((sx-dx)*nx+(sy-dy)*ny+(sz-dz)*nz<indist)
@@ -401,3 +402,14 @@ double* IcpPointToPlane::computeNormals (const int32_t num_neighbors,const doubl
   }
   return M_normal;
 }
+
+double IcpPointToPlane::nearestNeighborWithNormal (const float *query,float *nearest,float *normal) const {
+  std::vector<float>         q(query,query+dim);
+  kdtree::KDTreeResultVector result;
+  M_tree->n_nearest(q,1,result);
+  for (int32_t n=0; n<dim; n++) {
+    nearest[n] = M_tree->the_data[result[0].idx][n];
+    normal[n]  = (float)M_normal[result[0].idx*dim+n];
+  }
+  return result[0].dis;
+}
@@ -35,6 +35,16 @@ public:
     free(M_normal);
   }
 
+protected:
+
+  // for inherited classes providing their own model and normals, see nearestNeighborWithNormal
+  IcpPointToPlane (const int32_t dim) : Icp(dim), M_normal(0) {}
+
+  // nearest model point to query and its normal, must be thread-safe (called from openMP loops)
+  // the default implementation searches the kd tree and the normals computed in the constructor
+  // return: squared distance between query and nearest
+  virtual double nearestNeighborWithNormal (const float *query,float *nearest,float *normal) const;
+
 private:
 
   double fitStep (double *T,const int32_t T_num,Matrix &R,Matrix &t,const std::vector<int32_t> &active);
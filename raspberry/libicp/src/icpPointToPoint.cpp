@@ -55,9 +55,9 @@ double IcpPointToPoint::fitStep (double *T,const int32_t T_num,Matrix &R,Matrix
     // establish correspondences
 #pragma omp parallel for private(i) default(none) shared(T,active,nact,p_m,p_t,r00,r01,r10,r11,t0,t1) reduction(+:mum0,mum1, mut0,mut1) // schedule (dynamic,2)
     for (i=0; i<nact; i++) {
-      // kd tree query + result
-      std::vector<float>         query(dim);
-      kdtree::KDTreeResultVector result;
+      // query + nearest model point
+      float query[2];
+      float nearest[2];
   
       // get index of active point
       int32_t idx = active[i];
@@ -67,11 +67,11 @@ double IcpPointToPoint::fitStep (double *T,const int32_t T_num,Matrix &R,Matrix
       query[1] = (float)(r10*T[idx*2+0] + r11*T[idx*2+1] + t1);
 
       // search nearest neighbor
-      M_tree->n_nearest(query,1,result);
+      nearestNeighbor(query,nearest);
 
       // set model point
-      p_m.val[i][0] = M_tree->the_data[result[0].idx][0]; mum0 += p_m.val[i][0];
-      p_m.val[i][1] = M_tree->the_data[result[0].idx][1]; mum1 += p_m.val[i][1];
+      p_m.val[i][0] = nearest[0]; mum0 += p_m.val[i][0];
+      p_m.val[i][1] = nearest[1]; mum1 += p_m.val[i][1];
 
       // set template point
       p_t.val[i][0] = query[0]; mut0 += p_t.val[i][0];
@@ -97,9 +97,9 @@ double IcpPointToPoint::fitStep (double *T,const int32_t T_num,Matrix &R,Matrix
     // establish correspondences
 #pragma omp parallel for private(i) default(none) shared(T,active,nact,p_m,p_t,r00,r01,r02,r10,r11,r12,r20,r21,r22,t0,t1,t2) reduction(+:mum0,mum1,mum2, mut0,mut1,mut2) // schedule (dynamic,2)
     for (i=0; i<nact; i++) {
-      // kd tree query + result
-      std::vector<float>         query(dim);
-      kdtree::KDTreeResultVector result;
+      // query + nearest model point
+      float query[3];
+      float nearest[3];
 
       // get index of active point
       int32_t idx = active[i];
@@ -110,12 +110,12 @@ double IcpPointToPoint::fitStep (double *T,const int32_t T_num,Matrix &R,Matrix
       query[2] = (float)(r20*T[idx*3+0] + r21*T[idx*3+1] + r22*T[idx*3+2] + t2);
 
       // search nearest neighbor
-      M_tree->n_nearest(query,1,result);
+      nearestNeighbor(query,nearest);
 
       // set model point
-      p_m.val[i][0] = M_tree->the_data[result[0].idx][0]; mum0 += p_m.val[i][0];
-      p_m.val[i][1] = M_tree->the_data[result[0].idx][1]; mum1 += p_m.val[i][1];
-      p_m.val[i][2] = M_tree->the_data[result[0].idx][2]; mum2 += p_m.val[i][2];
+      p_m.val[i][0] = nearest[0]; mum0 += p_m.val[i][0];
+      p_m.val[i][1] = nearest[1]; mum1 += p_m.val[i][1];
+      p_m.val[i][2] = nearest[2]; mum2 += p_m.val[i][2];
 
       // set template point
       p_t.val[i][0] = query[0]; mut0 += p_t.val[i][0];
@@ -163,10 +163,10 @@ double IcpPointToPoint::fitStep (double *T,const int32_t T_num,Matrix &R,Matrix
 
 std::vector<int32_t> IcpPointToPoint::getInliers (double *T,const int32_t T_num,const Matrix &R,const Matrix &t,const double indist) {
 
-  // init inlier vector + query point + query result
+  // init inlier vector + query point + nearest model point
   vector<int32_t>            inliers;
-  std::vector<float>         query(dim);
-  kdtree::KDTreeResultVector neighbor;
+  float                      query[3];
+  float                      nearest[3];
   
   // dimensionality 2
   if (dim==2) {
@@ -183,11 +183,8 @@ std::vector<int32_t> IcpPointToPoint::getInliers (double *T,const int32_t T_num,
       query[0] = (float)(r00*T[i*2+0] + r01*T[i*2+1] + t0);
       query[1] = (float)(r10*T[i*2+0] + r11*T[i*2+1] + t1);
 
-      // search nearest neighbor
-      M_tree->n_nearest(query,1,neighbor);
-
-      // check if it is an inlier
-      if (neighbor[0].dis<indist)
+      // search nearest neighbor, check if it is an inlier
+      if (nearestNeighbor(query,nearest)<indist)
         inliers.push_back(i);
     }
     
@@ -208,11 +205,8 @@ std::vector<int32_t> IcpPointToPoint::getInliers (double *T,const int32_t T_num,
       query[1] = (float)(r10*T[i*3+0] + r11*T[i*3+1] + r12*T[i*3+2] + t1);
       query[2] = (float)(r20*T[i*3+0] + r21*T[i*3+1] + r22*T[i*3+2] + t2);
 
-      // search nearest neighbor
-      M_tree->n_nearest(query,1,neighbor);
-
-      // check if it is an inlier
-      if (neighbor[0].dis<indist)
+      // search nearest neighbor, check if it is an inlier
+      if (nearestNeighbor(query,nearest)<indist)
         inliers.push_back(i);
     }
   }
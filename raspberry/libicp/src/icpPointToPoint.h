@@ -30,6 +30,11 @@ public:
   IcpPointToPoint (double const* M,const int32_t M_num,const int32_t dim) : Icp(M,M_num,dim) {}
   virtual ~IcpPointToPoint () {}
 
+protected:
+
+  // for inherited classes providing their own model, see Icp::nearestNeighbor
+  IcpPointToPoint (const int32_t dim) : Icp(dim) {}
+
 private:
 
   double fitStep (double *T,const int32_t T_num,Matrix &R,Matrix &t,const std::vector<int32_t> &active);
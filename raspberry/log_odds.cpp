@@ -0,0 +1,84 @@
+#include "log_odds.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+// The fixed-point kernels use OpenCV's universal intrinsics, i.e.,
+// SSE2 on x86 and NEON on the Raspberry Pi. For 16 bit integers,
+// v_int16x8 arithmetic saturates.
+
+void AddLogOdds(float* pf, int cn, float fDelta) {
+    for(int i = 0; i<cn; ++i) {
+        pf[i] += fDelta;
+    }
+}
+
+void AddLogOdds(std::int16_t* pn, int cn, std::int16_t nDelta) {
+    int i = 0;
+#if CV_SIMD128
+    cv::v_int16x8 const vnDelta = cv::v_setall_s16(nDelta);
+    for(; i + cv::v_int16x8::nlanes <= cn; i += cv::v_int16x8::nlanes) {
+        cv::v_store(pn + i, cv::v_load(pn + i) + vnDelta);
+    }
+#endif
+    for(; i<cn; ++i) {
+        pn[i] = SLogOddsTraits<std::int16_t>::Add(pn[i], nDelta);
+    }
+}
+
+namespace {
+    template<typename T>
+    std::uint8_t ThresholdCell(T t, T tThreshold) {
+        return tThreshold<t
+            ? 0 // occupied
+            : (t < -tThreshold ? 255 : 128);
+    }
+}
+
+void ThresholdLogOdds(float const* pf, std::uint8_t* pb, int cn, float fThreshold) {
+    for(int i = 0; i<cn; ++i) {
+        pb[i] = ThresholdCell(pf[i], fThreshold);
+    }
+}
+
+void ThresholdLogOdds(std::int16_t const* pn, std::uint8_t* pb, int cn, std::int16_t nThreshold) {
+    int i = 0;
+#if CV_SIMD128
+    cv::v_int16x8 const vnThreshold = cv::v_setall_s16(nThreshold);
+    cv::v_int16x8 const vnNegThreshold = cv::v_setall_s16(-nThreshold);
+    cv::v_int16x8 const vnOccupied = cv::v_setall_s16(0);
+    cv::v_int16x8 const vnFree = cv::v_setall_s16(255);
+    cv::v_int16x8 const vnUnknown = cv::v_setall_s16(128);
+
+    auto Classify = [&](cv::v_int16x8 const& vn) {
+        return cv::v_select(vnThreshold < vn, vnOccupied, cv::v_select(vn < vnNegThreshold, vnFree, vnUnknown));
+    };
+    for(; i + 2*cv::v_int16x8::nlanes <= cn; i += 2*cv::v_int16x8::nlanes) {
+        cv::v_store(pb + i, cv::v_pack_u(
+            Classify(cv::v_load(pn + i)),
+            Classify(cv::v_load(pn + i + cv::v_int16x8::nlanes))
+        ));
+    }
+#endif
+    for(; i<cn; ++i) {
+        pb[i] = ThresholdCell(pn[i], nThreshold);
+    }
+}
+
+int FindChangedCells(std::uint8_t const* pbA, std::uint8_t const* pbB, int cn, int* pi) {
+    int c = 0;
+    int i = 0;
+#if CV_SIMD128
+    // Most cells keep their state, skip 16 unchanged cells at a time
+    for(; i + cv::v_uint8x16::nlanes <= cn; i += cv::v_uint8x16::nlanes) {
+        if(!cv::v_check_any(cv::v_load(pbA + i) != cv::v_load(pbB + i))) continue;
+        for(int j = i; j < i + cv::v_uint8x16::nlanes; ++j) {
+            if(pbA[j]!=pbB[j]) pi[c++] = j;
+        }
+    }
+#endif
+    for(; i<cn; ++i) {
+        if(pbA[i]!=pbB[i]) pi[c++] = i;
+    }
+    return c;
+}
@@ -2,6 +2,8 @@
 
 #include "rover.h"
 #include "scanline.h"
+#include "thread_pool.h"
+#include "random_generator.h"
 
 #include <chrono>
 #include <iostream>
@@ -16,13 +18,22 @@ constexpr char c_szLIDAR[] = "lidar";
 constexpr char c_szLOG[] = "log";
 constexpr char c_szMANUAL[] = "manual";
 constexpr char c_szMAP[] = "map";
+constexpr char c_szLOADMAP[] = "load-map";
+constexpr char c_szSAVEMAP[] = "save-map";
+constexpr char c_szTHREADS[] = "threads";
+constexpr char c_szSEED[] = "seed";
+constexpr char c_szLOCALIZE[] = "localize";
+constexpr char c_szRELOCALIZE[] = "relocalize";
+constexpr char c_szPOSEGRAPH[] = "pose-graph";
 
 constexpr char c_szINPUT[] = "input-file";
 constexpr char c_szVIDEO[] = "video";
 constexpr char c_szOUTPUT[] = "out";
 
-int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> const& ostrOutput);
-int ConnectToRobot(std::string const& strPort, std::string const& strLidar, std::ofstream& ofsLog, bool bManual, boost::optional<std::string> const& ostrOutput);
+int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> const& ostrOutput, 
+	boost::optional<std::string> const& ostrLoadMap, boost::optional<std::string> const& ostrSaveMap, bool bLocalize, bool bPoseGraph, bool bRelocalize);
+int ConnectToRobot(std::string const& strPort, std::string const& strLidar, std::ofstream& ofsLog, bool bManual, boost::optional<std::string> const& ostrOutput, 
+	boost::optional<std::string> const& ostrLoadMap, boost::optional<std::string> const& ostrSaveMap, bool bLocalize, bool bPoseGraph, bool bRelocalize);
 
 int main(int nArgs, char* aczArgs[]) {
 	namespace po = boost::program_options;
@@ -40,7 +51,14 @@ int main(int nArgs, char* aczArgs[]) {
 	    (c_szHELP, "Print help message")
 	    (c_szPORT, po::value<std::string>()->value_name("p"), "Connect to robot on port <p>")
 	    (c_szLIDAR, po::value<std::string>()->value_name("l"), "Connect to Lidar sensor on port <p>")
-	    (c_szINPUT, po::value<std::string>()->value_name("file"), "Read sensor data from input file <file>");
+	    (c_szINPUT, po::value<std::string>()->value_name("file"), "Read sensor data from input file <file>")
+	    (c_szLOADMAP, po::value<std::string>()->value_name("file"), "Start from the map snapshot <file>")
+	    (c_szSAVEMAP, po::value<std::string>()->value_name("file"), "Save a map snapshot to <file>")
+	    (c_szLOCALIZE, "Only localize on the map loaded with --load-map instead of mapping")
+	    (c_szPOSEGRAPH, "Map with pose graph optimization and loop closures instead of the particle filter")
+	    (c_szRELOCALIZE, "Search the robot's pose on the map loaded with --load-map instead of starting at the saved pose")
+	    (c_szTHREADS, po::value<int>()->value_name("n"), "Update particles on <n> threads, default is the number of cores")
+	    (c_szSEED, po::value<std::uint64_t>()->value_name("n"), "Seed the random number generators with <n>, runs with the same seed and input file are identical");
 
 	po::options_description optdescRobot("Robot options");
 	optdescRobot.add_options()
@@ -63,7 +81,38 @@ int main(int nArgs, char* aczArgs[]) {
 	if(vm.count(c_szHELP)) {
 		std::cout << optdesc << std::endl;
 		return 0;
-	} else if(vm.count(c_szINPUT)) {
+	}
+
+	boost::optional<std::string> const ostrLoadMap = vm.count(c_szLOADMAP)
+		? boost::make_optional(vm[c_szLOADMAP].as<std::string>())
+		: boost::none;
+	boost::optional<std::string> const ostrSaveMap = vm.count(c_szSAVEMAP)
+		? boost::make_optional(vm[c_szSAVEMAP].as<std::string>())
+		: boost::none;
+
+	if(vm.count(c_szTHREADS)) {
+		if(vm[c_szTHREADS].as<int>()<1) {
+			std::cerr << "--" << c_szTHREADS << " must be at least 1" << std::endl;
+			return 1;
+		}
+		ConfigureThreadPool(vm[c_szTHREADS].as<int>());
+	}
+	bool const bLocalize = vm.count(c_szLOCALIZE);
+	bool const bRelocalize = vm.count(c_szRELOCALIZE);
+	if((bLocalize || bRelocalize) && !ostrLoadMap) {
+		std::cerr << "--" << (bLocalize ? c_szLOCALIZE : c_szRELOCALIZE) << " requires --" << c_szLOADMAP << std::endl;
+		return 1;
+	}
+	bool const bPoseGraph = vm.count(c_szPOSEGRAPH);
+	if(bLocalize && bPoseGraph) {
+		std::cerr << "--" << c_szLOCALIZE << " and --" << c_szPOSEGRAPH << " cannot be combined" << std::endl;
+		return 1;
+	}
+	if(vm.count(c_szSEED)) {
+		SetRandomSeed(vm[c_szSEED].as<std::uint64_t>());
+	}
+
+	if(vm.count(c_szINPUT)) {
 		// Read saved sensor data from log file 
 		auto const strLogFile = vm[c_szINPUT].as<std::string>();
 		std::ifstream ifs(strLogFile.c_str());
@@ -77,7 +126,7 @@ int main(int nArgs, char* aczArgs[]) {
              ? boost::make_optional(vm[c_szOUTPUT].as<std::string>())
              : boost::none;
         
-         return ParseLogFile(ifs, bVideo, ostrOutput);		
+         return ParseLogFile(ifs, bVideo, ostrOutput, ostrLoadMap, ostrSaveMap, bLocalize, bPoseGraph, bRelocalize);		
 	} else if(vm.count(c_szPORT) && vm.count(c_szLIDAR)) {
 		// Read serial port, log file name etc
 		auto const strPort = vm[c_szPORT].as<std::string>();
@@ -94,7 +143,7 @@ int main(int nArgs, char* aczArgs[]) {
         if(vm.count(c_szMAP)) {
 			strOutput = vm[c_szMAP].as<std::string>();
 		}
-        return ConnectToRobot(strPort, strLidar, ofsLog, bManual, strOutput);
+        return ConnectToRobot(strPort, strLidar, ofsLog, bManual, strOutput, ostrLoadMap, ostrSaveMap, bLocalize, bPoseGraph, bRelocalize);
 	} else {
 		std::cerr << "You must specify either the port to read from or an input file to parse" << std::endl;
 		std::cerr << optdesc << std::endl;
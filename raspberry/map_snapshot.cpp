@@ -0,0 +1,211 @@
+#include "map_snapshot.h"
+#include "scanmatching.h"
+#include "robot_configuration.h"
+#include "error_handling.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    using STile = CTiledGrid<std::int16_t>::STile;
+
+    constexpr char c_achMagic[8] = {'R', 'B', 'T', 'M', 'A', 'P', 0, 0};
+    constexpr std::uint32_t c_nVersion = 1;
+    constexpr std::uint64_t c_cbAlignment = 64; // alignment of each section in the file
+
+    struct SMapSnapshotHeader {
+        char m_achMagic[8];
+        std::uint32_t m_nVersion;
+        // Map configuration, a snapshot can only be loaded with the same configuration
+        std::uint32_t m_nScale; // c_nScale
+        std::uint32_t m_nTileExtent; // c_nTileExtent
+        std::uint32_t m_nLogOddsScale; // SLogOddsTraits<std::int16_t>::c_nLogOddsScale
+        std::int32_t m_anBounds[4]; // COccupancyGridBaseT::m_rectnBounds, left, bottom, right, top
+
+        std::uint64_t m_cTiles;
+        std::uint64_t m_cObstacles;
+        std::uint64_t m_cPoses;
+
+        // Byte offsets from start of file
+        std::uint64_t m_ibTileCoordinates; // m_cTiles x 2 std::int32_t
+        std::uint64_t m_ibTiles; // m_cTiles x STile
+        std::uint64_t m_ibObstacles; // m_cObstacles x 2 std::int32_t
+        std::uint64_t m_ibPoses; // m_cPoses x 3 double (x, y, yaw)
+    };
+    static_assert(std::is_standard_layout<SMapSnapshotHeader>::value, "");
+    static_assert(sizeof(STile)==c_nTileExtent*c_nTileExtent*sizeof(std::int16_t), "");
+
+    std::uint64_t Align(std::uint64_t ib) {
+        return (ib + c_cbAlignment - 1) / c_cbAlignment * c_cbAlignment;
+    }
+
+    template<typename T>
+    void Write(std::ostream& os, T const* pt, std::size_t ct) {
+        os.write(reinterpret_cast<char const*>(pt), ct * sizeof(T));
+    }
+
+    void Pad(std::ostream& os, std::uint64_t ib) {
+        char const achZero[c_cbAlignment] = {0};
+        Write(os, achZero, ib - static_cast<std::uint64_t>(os.tellp()));
+    }
+
+    bool ValidSection(std::uint64_t ib, std::uint64_t c, std::uint64_t cbElement, std::uint64_t cbFile) {
+        return ib%c_cbAlignment==0 && ib<=cbFile && c<=(cbFile - ib)/cbElement;
+    }
+}
+
+bool SaveMapSnapshot(std::string const& strFile, COccupancyGridWithObstacleList const& occgrid, std::vector<rbt::pose<double>> const& vecpose) {
+    std::vector<std::int32_t> vecnTileCoordinates;
+    std::vector<STile const*> vecptile;
+    occgrid.m_gridLogOdds.ForEachTile([&](rbt::point<int> const& ptOrigin, std::int16_t const* pn) {
+        vecnTileCoordinates.emplace_back(ptOrigin.x / c_nTileExtent);
+        vecnTileCoordinates.emplace_back(ptOrigin.y / c_nTileExtent);
+        vecptile.emplace_back(reinterpret_cast<STile const*>(pn));
+    });
+
+    std::vector<std::int32_t> vecnObstacles;
+    occgrid.m_dirvecptOccupied.ForEachTile([&](rbt::point<int> const&, std::vector<rbt::point<int>> const& vecpt) {
+        boost::for_each(vecpt, [&](rbt::point<int> const& pt) {
+            vecnObstacles.emplace_back(pt.x);
+            vecnObstacles.emplace_back(pt.y);
+        });
+    });
+
+    std::vector<double> vecfPoses;
+    boost::for_each(vecpose, [&](rbt::pose<double> const& pose) {
+        vecfPoses.emplace_back(pose.m_pt.x);
+        vecfPoses.emplace_back(pose.m_pt.y);
+        vecfPoses.emplace_back(pose.m_fYaw);
+    });
+
+    SMapSnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.m_achMagic, c_achMagic, sizeof(c_achMagic));
+    header.m_nVersion = c_nVersion;
+    header.m_nScale = c_nScale;
+    header.m_nTileExtent = c_nTileExtent;
+    header.m_nLogOddsScale = SLogOddsTraits<std::int16_t>::c_nLogOddsScale;
+    header.m_anBounds[0] = occgrid.m_rectnBounds.left;
+    header.m_anBounds[1] = occgrid.m_rectnBounds.bottom;
+    header.m_anBounds[2] = occgrid.m_rectnBounds.right;
+    header.m_anBounds[3] = occgrid.m_rectnBounds.top;
+    header.m_cTiles = vecptile.size();
+    header.m_cObstacles = vecnObstacles.size() / 2;
+    header.m_cPoses = vecpose.size();
+    header.m_ibTileCoordinates = Align(sizeof(SMapSnapshotHeader));
+    header.m_ibTiles = Align(header.m_ibTileCoordinates + vecnTileCoordinates.size() * sizeof(std::int32_t));
+    header.m_ibObstacles = Align(header.m_ibTiles + vecptile.size() * sizeof(STile));
+    header.m_ibPoses = Align(header.m_ibObstacles + vecnObstacles.size() * sizeof(std::int32_t));
+
+    // Write to a temporary file first, so an existing snapshot is only replaced by a complete one
+    auto const strFileTemp = strFile + ".tmp";
+    {
+        std::ofstream ofs(strFileTemp, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+        Write(ofs, &header, 1);
+        Pad(ofs, header.m_ibTileCoordinates);
+        Write(ofs, vecnTileCoordinates.data(), vecnTileCoordinates.size());
+        Pad(ofs, header.m_ibTiles);
+        boost::for_each(vecptile, [&](STile const* ptile) {
+            Write(ofs, ptile->data(), ptile->size());
+        });
+        Pad(ofs, header.m_ibObstacles);
+        Write(ofs, vecnObstacles.data(), vecnObstacles.size());
+        Pad(ofs, header.m_ibPoses);
+        Write(ofs, vecfPoses.data(), vecfPoses.size());
+
+        if(!ofs.good()) {
+            std::cerr << "Error writing map snapshot to " << strFileTemp << std::endl;
+            return false;
+        }
+    }
+    if(0!=std::rename(strFileTemp.c_str(), strFile.c_str())) {
+        std::cerr << "Error renaming " << strFileTemp << " to " << strFile << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool LoadMapSnapshot(std::string const& strFile, COccupancyGridWithObstacleList& occgrid, std::vector<rbt::pose<double>>& vecpose) {
+    auto Error = [&](char const* szError) {
+        std::cerr << "Error loading map snapshot " << strFile << ": " << szError << std::endl;
+        return false;
+    };
+
+    int const fd = open(strFile.c_str(), O_RDONLY);
+    if(fd<0) return Error("Couldn't open file");
+
+    struct stat st;
+    if(0!=fstat(fd, &st)) {
+        close(fd);
+        return Error("Couldn't read file size");
+    }
+    auto const cbFile = static_cast<std::uint64_t>(st.st_size);
+    if(cbFile<sizeof(SMapSnapshotHeader)) {
+        close(fd);
+        return Error("File too small");
+    }
+
+    // MAP_PRIVATE: Writes to the mapping are never written back to the file
+    void* pvMapping = mmap(nullptr, cbFile, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if(MAP_FAILED==pvMapping) return Error("mmap failed");
+
+    // Owns the mapping, all tiles alias it
+    std::shared_ptr<void> spvMapping(pvMapping, [cbFile](void* pv) { munmap(pv, cbFile); });
+    auto const* pbMapping = static_cast<char const*>(pvMapping);
+
+    auto const& header = *static_cast<SMapSnapshotHeader const*>(pvMapping);
+    if(0!=std::memcmp(header.m_achMagic, c_achMagic, sizeof(c_achMagic))) return Error("Not a map snapshot");
+    if(c_nVersion!=header.m_nVersion) return Error("Unsupported version");
+    if(c_nScale!=header.m_nScale
+    || c_nTileExtent!=header.m_nTileExtent
+    || SLogOddsTraits<std::int16_t>::c_nLogOddsScale!=header.m_nLogOddsScale) {
+        return Error("Map configuration differs");
+    }
+    if(!ValidSection(header.m_ibTileCoordinates, header.m_cTiles, 2*sizeof(std::int32_t), cbFile)
+    || !ValidSection(header.m_ibTiles, header.m_cTiles, sizeof(STile), cbFile)
+    || !ValidSection(header.m_ibObstacles, header.m_cObstacles, 2*sizeof(std::int32_t), cbFile)
+    || !ValidSection(header.m_ibPoses, header.m_cPoses, 3*sizeof(double), cbFile)) {
+        return Error("File is truncated or corrupt");
+    }
+
+    COccupancyGridWithObstacleList occgridLoaded;
+    occgridLoaded.m_rectnBounds = rbt::rect<int>{header.m_anBounds[0], header.m_anBounds[1], header.m_anBounds[2], header.m_anBounds[3]};
+
+    auto const* pnTileCoordinates = reinterpret_cast<std::int32_t const*>(pbMapping + header.m_ibTileCoordinates);
+    auto* ptile = reinterpret_cast<STile*>(static_cast<char*>(pvMapping) + header.m_ibTiles);
+    for(std::uint64_t i = 0; i<header.m_cTiles; ++i, ++ptile) {
+        occgridLoaded.m_gridLogOdds.SetTile(
+            rbt::point<int>(pnTileCoordinates[2*i], pnTileCoordinates[2*i+1]),
+            std::shared_ptr<STile>(spvMapping, ptile) // aliasing constructor, shares ownership of the mapping
+        );
+    }
+
+    auto const* pnObstacles = reinterpret_cast<std::int32_t const*>(pbMapping + header.m_ibObstacles);
+    for(std::uint64_t i = 0; i<header.m_cObstacles; ++i) {
+        rbt::point<int> const pt(pnObstacles[2*i], pnObstacles[2*i+1]);
+        occgridLoaded.m_dirvecptOccupied.mutable_tile(
+            decltype(occgridLoaded.m_dirvecptOccupied)::TileCoordinate(pt),
+            [](std::vector<rbt::point<int>>&) {}
+        ).emplace_back(pt);
+    }
+    occgridLoaded.rebuildObstacleMap();
+
+    auto const* pfPoses = reinterpret_cast<double const*>(pbMapping + header.m_ibPoses);
+    std::vector<rbt::pose<double>> vecposeLoaded;
+    for(std::uint64_t i = 0; i<header.m_cPoses; ++i) {
+        vecposeLoaded.emplace_back(rbt::point<double>(pfPoses[3*i], pfPoses[3*i+1]), pfPoses[3*i+2]);
+    }
+
+    occgrid = std::move(occgridLoaded);
+    vecpose = std::move(vecposeLoaded);
+    return true;
+}
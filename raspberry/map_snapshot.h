@@ -0,0 +1,21 @@
+#pragma once
+
+#include "geometry.h"
+
+#include <string>
+#include <vector>
+
+struct COccupancyGridWithObstacleList;
+
+// Binary map snapshot containing the log odds tiles of an occupancy grid,
+// its obstacle list and the robot's pose history.
+//
+// The file starts with an SMapSnapshotHeader, followed by the tile coordinates and
+// the std::int16_t tiles in native byte order. LoadMapSnapshot maps the file
+// with mmap(MAP_PRIVATE) and the loaded grid references the tiles in the mapping
+// directly. The tiles are copied on first write like any other shared tile.
+//
+// Both functions print an error message and return false if the file cannot be
+// written or read, or if it has been written with a different map configuration.
+bool SaveMapSnapshot(std::string const& strFile, COccupancyGridWithObstacleList const& occgrid, std::vector<rbt::pose<double>> const& vecpose);
+bool LoadMapSnapshot(std::string const& strFile, COccupancyGridWithObstacleList& occgrid, std::vector<rbt::pose<double>>& vecpose);
@@ -0,0 +1,190 @@
+#include "monte_carlo_localization.h"
+#include "robot_configuration.h"
+#include "error_handling.h"
+#include "occupancy_grid.h"
+#include "occupancy_grid.inl"
+#include "map_snapshot.h"
+#include "thread_pool.h"
+#include "random_generator.h"
+#include "particle_weights.h"
+#include "correlative_scan_matcher.h"
+
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace {
+    // Log likelihood of a scan point at distance fDistance (in grid cells) to the closest obstacle,
+    // see measurement_model_map
+    float ScanPointLogLikelihood(float fDistance) {
+        return static_cast<float>(std::log(measurement_model_point(fDistance)));
+    }
+}
+
+CMonteCarloLocalization::CMonteCarloLocalization(int cParticles)
+    : m_matnMap(m_occgrid.ObstacleMap())
+    , m_rectnLogLikelihood(rbt::rect<int>::empty())
+    , m_vecposeParticle(cParticles, rbt::pose<double>::zero())
+    , m_vecfLogWeight(cParticles, 0.0)
+    , m_vecfWeight(cParticles, 1.0/cParticles)
+    , m_bRelocalize(false)
+{
+    ASSERT(0<cParticles);
+}
+
+bool CMonteCarloLocalization::LoadMap(std::string const& strFile, bool bRelocalize) {
+    std::vector<rbt::pose<double>> vecpose;
+    if(!LoadMapSnapshot(strFile, m_occgrid, vecpose)) return false;
+
+    m_matnMap = m_occgrid.ObstacleMap();
+    
+    // Precompute the likelihood field once for the whole mapped area, the map never changes
+    m_rectnLogLikelihood = m_occgrid.Bounds();
+    if(m_rectnLogLikelihood.right < m_rectnLogLikelihood.left) {
+        LOG("Map " << strFile << " is empty");
+        return false;
+    }
+    auto const matfDistance = m_occgrid.DistanceField().ToMat(m_rectnLogLikelihood);
+    m_matfLogLikelihood.create(matfDistance.rows, matfDistance.cols, CV_32FC1);
+    for(int y = 0; y < matfDistance.rows; ++y) {
+        auto const* pfDistance = matfDistance.ptr<float>(y);
+        auto* pfLogLikelihood = m_matfLogLikelihood.ptr<float>(y);
+        for(int x = 0; x < matfDistance.cols; ++x) {
+            pfLogLikelihood[x] = ScanPointLogLikelihood(pfDistance[x]);
+        }
+    }
+
+    auto const pose = vecpose.empty() ? rbt::pose<double>::zero() : vecpose.back();
+    std::fill(m_vecposeParticle.begin(), m_vecposeParticle.end(), pose);
+    std::fill(m_vecfLogWeight.begin(), m_vecfLogWeight.end(), 0.0);
+    std::fill(m_vecfWeight.begin(), m_vecfWeight.end(), 1.0/m_vecfWeight.size());
+    m_vecpose = std::move(vecpose);
+    m_odomacc = SOdometryAccumulator();
+    m_bRelocalize = bRelocalize;
+    return true;
+}
+
+bool CMonteCarloLocalization::SaveMap(std::string const& strFile) const {
+    return SaveMapSnapshot(strFile, m_occgrid, m_vecpose);
+}
+
+double CMonteCarloLocalization::LogLikelihood(rbt::pose<double> const& pose, SScanLine const& scanline) const {
+    // Scan points outside of the mapped area are in unknown space
+    auto const fLogLikelihoodUnknown = ScanPointLogLikelihood(c_nMaxObstacleDistance);
+
+    double fLogLikelihood = 0.0;
+    boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
+        auto const pt = ToGridCoordinate(Obstacle(pose, scan.m_fRadAngle, scan.m_nDistance));
+        fLogLikelihood += m_rectnLogLikelihood.left<=pt.x && pt.x<=m_rectnLogLikelihood.right 
+            && m_rectnLogLikelihood.bottom<=pt.y && pt.y<=m_rectnLogLikelihood.top
+            ? m_matfLogLikelihood.at<float>(pt.y - m_rectnLogLikelihood.bottom, pt.x - m_rectnLogLikelihood.left)
+            : fLogLikelihoodUnknown;
+    });
+    return fLogLikelihood;
+}
+
+bool CMonteCarloLocalization::receivedSensorData(SScanLine const& scanlineSensor) {
+    ASSERT(!m_matfLogLikelihood.empty()); // LoadMap must be called first
+
+    SScanLine scanline;
+    if(!m_odomacc.add(scanlineSensor, /*bForce*/ m_bRelocalize, scanline)) return false;
+    if(m_bRelocalize) relocalize(scanline);
+
+    // 1. Sample motion model and weigh particles with a downsampled scan line
+    auto const scanlineMatch = scanline.downsampled();
+    ThreadPool().parallel_for(m_vecposeParticle.size(), [&](std::size_t i) {
+        SeedRandomGenerator(m_vecpose.size(), i);
+        m_vecposeParticle[i] = sample_motion_model(m_vecposeParticle[i], scanline.translation(), scanline.rotation());
+        m_vecfLogWeight[i] += LogLikelihood(m_vecposeParticle[i], scanlineMatch);
+    });
+
+    // 2. Normalize weights and resample if the weights degenerated
+    auto const fNEff = NormalizeLogWeights(m_vecfLogWeight, 1.0, m_vecfWeight);
+    m_vecpose.emplace_back(ClusterMeanPose());
+
+    if(fNEff < 0.5 * m_vecposeParticle.size()) {
+        LOG("============ Resample ============");
+        // Key differs from all particle tasks, the thread may have run any of them
+        SeedRandomGenerator(m_vecpose.size(), m_vecposeParticle.size());
+        auto const veciparticle = SystematicResample(
+            m_vecfWeight, 
+            m_vecposeParticle.size(), 
+            std::uniform_real_distribution<double>(0.0, 1.0)(RandomGenerator())
+        );
+
+        std::vector<rbt::pose<double>> vecposeParticle;
+        vecposeParticle.reserve(veciparticle.size());
+        boost::for_each(veciparticle, [&](int i) { vecposeParticle.emplace_back(m_vecposeParticle[i]); });
+        m_vecposeParticle = std::move(vecposeParticle);
+        std::fill(m_vecfLogWeight.begin(), m_vecfLogWeight.end(), 0.0);
+        std::fill(m_vecfWeight.begin(), m_vecfWeight.end(), 1.0/m_vecfWeight.size());
+    }
+    return true;
+}
+
+void CMonteCarloLocalization::relocalize(SScanLine& scanline) {
+    m_bRelocalize = false;
+    auto const vechyp = GlobalRelocalization(scanline.downsampled(), m_occgrid);
+    if(vechyp.empty()) {
+        LOG("Relocalization failed, continuing from the saved pose");
+        return;
+    }
+
+    double fScoreSum = 0;
+    boost::for_each(vechyp, [&](SPoseHypothesis const& hyp) { 
+        LOG("Hypothesis " << hyp.m_pose << " score = " << hyp.m_fScore);
+        fScoreSum += hyp.m_fScore; 
+    });
+    std::vector<double> vecfScore;
+    boost::for_each(vechyp, [&](SPoseHypothesis const& hyp) { vecfScore.emplace_back(hyp.m_fScore / fScoreSum); });
+    auto const vecihyp = SystematicResample(vecfScore, m_vecposeParticle.size(), 0.5);
+    for(std::size_t i = 0; i < vecihyp.size(); ++i) {
+        m_vecposeParticle[i] = vechyp[vecihyp[i]].m_pose;
+    }
+    std::fill(m_vecfLogWeight.begin(), m_vecfLogWeight.end(), 0.0);
+    std::fill(m_vecfWeight.begin(), m_vecfWeight.end(), 1.0/m_vecfWeight.size());
+    scanline.m_pose = rbt::pose<double>::zero();
+}
+
+rbt::pose<double> CMonteCarloLocalization::ClusterMeanPose() const {
+    auto const poseBest = m_vecposeParticle[std::max_element(m_vecfWeight.begin(), m_vecfWeight.end()) - m_vecfWeight.begin()];
+
+    auto szf = rbt::size<double>::zero();
+    double fCos = 0;
+    double fSin = 0;
+    double fWeightSum = 0;
+    for(std::size_t i = 0; i < m_vecposeParticle.size(); ++i) {
+        auto const& pose = m_vecposeParticle[i];
+        if(rbt::sqr(c_nRelocalizationSeparation * c_nScale) < (pose.m_pt - poseBest.m_pt).SqrAbs()
+        || rbt::rad(c_fRelocalizationSeparationAngle) < std::abs(std::remainder(pose.m_fYaw - poseBest.m_fYaw, 2*M_PI))) {
+            continue;
+        }
+        szf += rbt::size<double>(pose.m_pt) * m_vecfWeight[i];
+        fCos += std::cos(pose.m_fYaw) * m_vecfWeight[i];
+        fSin += std::sin(pose.m_fYaw) * m_vecfWeight[i];
+        fWeightSum += m_vecfWeight[i];
+    }
+    ASSERT(0 < fWeightSum); // contains poseBest
+    szf /= fWeightSum;
+    return rbt::pose<double>(rbt::point<double>(szf.x, szf.y), std::atan2(fSin, fCos));
+}
+
+cv::Mat CMonteCarloLocalization::getMapWithPoses() const {
+    return ObstacleMapWithPoses(m_matnMap.clone(), m_vecpose);
+}
+
+cv::Mat CMonteCarloLocalization::getMap() const {
+    return m_matnMap.clone(); // callers draw into the map
+}
+
+std::vector<cv::Mat> CMonteCarloLocalization::getMapPyramid() {
+    return m_occgrid.ObstacleMapPyramid(c_rectnMapWindow);
+}
+
+cv::Mat CMonteCarloLocalization::getMapWithPose() const {
+    cv::Mat matColor;
+    cvtColor(m_matnMap, matColor, CV_GRAY2RGB);
+    if(!m_vecpose.empty()) RenderRobotPose(matColor, m_vecpose.back(), cv::Scalar(255, 0, 0));
+    return matColor;
+}
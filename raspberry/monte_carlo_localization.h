@@ -0,0 +1,66 @@
+#pragma once
+
+#include "geometry.h"
+#include "nonmoveable.h"
+#include "scanline.h"
+#include "scanmatching.h"
+
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// Monte Carlo localization on a static map, see Thrun et al "Probabilistic Robotics" p 252
+// and the likelihood field model p 169ff.
+//
+// Unlike CFastParticleSlamBase, the particles are only poses. The map is loaded 
+// once, and the log likelihood of a scan point in every cell of the mapped area 
+// is precomputed from its distance field. Scoring a particle is a table lookup 
+// per scan point and the map is never updated.
+struct CMonteCarloLocalization : rbt::nonmoveable {
+    explicit CMonteCarloLocalization(int cParticles = 200);
+
+    // Loads the static map, fails if the map is empty. The particles start at the last saved pose, 
+    // i.e., the robot must be where the snapshot was taken.
+    // If bRelocalize, the particles are distributed over the hypotheses found by 
+    // GlobalRelocalization with the next scan line instead.
+    // Must be called before the first call to receivedSensorData.
+    bool LoadMap(std::string const& strFile, bool bRelocalize = false);
+    // Saves the static map with the localized poses
+    bool SaveMap(std::string const& strFile) const;
+
+    // Updates the particles if the robot moved by c_fUpdateDistance or turned by 
+    // c_fUpdateAngle since the last update and returns true, see SOdometryAccumulator
+    bool receivedSensorData(SScanLine const& scanline);
+
+    cv::Mat getMapWithPoses() const;
+    cv::Mat getMapWithPose() const;
+    cv::Mat getMap() const;
+    std::vector<cv::Mat> getMapPyramid();
+
+    std::vector<rbt::pose<double>> const& Poses() const { return m_vecpose; } 
+
+private:
+    double LogLikelihood(rbt::pose<double> const& pose, SScanLine const& scanline) const;
+    // Distributes the particles over the hypotheses of GlobalRelocalization in proportion
+    // to their scores. Clears the odometry of scanline, which is relative to the unknown previous pose.
+    void relocalize(SScanLine& scanline);
+    // Weighted mean of the particles around the particle with the highest weight, i.e., within
+    // c_nRelocalizationSeparation px and c_fRelocalizationSeparationAngle degrees of it. After
+    // relocalize, the particles are spread over several hypotheses and the mean of all of them 
+    // may lie between the hypotheses.
+    rbt::pose<double> ClusterMeanPose() const;
+
+    COccupancyGridWithObstacleList m_occgrid; // static map
+    cv::Mat m_matnMap; // renders c_rectnMapWindow
+    rbt::rect<int> m_rectnLogLikelihood; // bounds of the static map
+    cv::Mat m_matfLogLikelihood; // log likelihood of a scan point in each cell of m_rectnLogLikelihood
+
+    // Particle set as structure of arrays
+    std::vector<rbt::pose<double>> m_vecposeParticle;
+    std::vector<double> m_vecfLogWeight;
+    std::vector<double> m_vecfWeight; // normalized
+
+    SOdometryAccumulator m_odomacc;
+    bool m_bRelocalize; // relocalize with the next scan line
+    std::vector<rbt::pose<double>> m_vecpose; // history of estimated poses
+};
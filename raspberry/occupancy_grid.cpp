@@ -12,31 +12,47 @@
 #include <opencv2/imgproc.hpp>
 
 COccupancyGrid::COccupancyGrid()
-:   m_matnMapObstacle(c_nMapExtent, c_nMapExtent, CV_8UC1, cv::Scalar(128))
+:   m_gridnObstacle(128)
 {}
 
 COccupancyGrid::COccupancyGrid(COccupancyGrid const& occgrid) 
-:   COccupancyGridBaseT(occgrid), m_matnMapObstacle(occgrid.m_matnMapObstacle.clone())
+:   COccupancyGridBaseT(occgrid), m_gridnObstacle(occgrid.m_gridnObstacle), m_distfield(occgrid.m_distfield)
 {}
 
 COccupancyGrid& COccupancyGrid::operator=(COccupancyGrid const& occgrid) {
     COccupancyGridBaseT::operator=(occgrid); 
-    m_matnMapObstacle=occgrid.m_matnMapObstacle.clone();
+    m_gridnObstacle=occgrid.m_gridnObstacle;
+    m_distfield=occgrid.m_distfield;
     return *this;
 }
 
+cv::Mat COccupancyGrid::ObstacleMap() const {
+    return ObstacleMap(c_rectnMapWindow);
+}
+
+cv::Mat COccupancyGrid::ObstacleMap(rbt::rect<int> const& rectn) const {
+    return m_gridnObstacle.ToMat(rectn);
+}
+
 void COccupancyGrid::updateGrid(rbt::point<int> const& pt, double fOdds) {
     // Calculating the greyscale map is pretty expensive
     // If we ever need a non-binary version, a lookup table
     // would be useful instead of this:
     // auto const nColor = rbt::numeric_cast<std::uint8_t>(1.0 / ( 1.0 + std::exp( fOdds )) * 255);
-    assert(is_inside(pt));
-    m_matnMapObstacle.at<std::uint8_t>(pt.y, pt.x) = 0 < fOdds ? 0 : 255;
+    updateObstacleMap(pt, 0 < fOdds ? 0 : 255);
 }
 
 void COccupancyGrid::updateGridPoly(std::vector<rbt::point<int>> const& rngpt, double fOdds) {
-    std::vector<cv::Point> vecpt(boost::begin(rngpt), boost::end(rngpt));
-    cv::fillConvexPoly(m_matnMapObstacle, vecpt.data(), vecpt.size(), 0 < fOdds ? 0 : 255);
+    boost::for_each(RasterizeConvexPolygon(rngpt), [&](rbt::point<int> const& pt) {
+        updateObstacleMap(pt, 0 < fOdds ? 0 : 255);
+    });
+}
+
+void COccupancyGrid::updateObstacleMap(rbt::point<int> const& pt, std::uint8_t nColor) {
+    if(nColor!=m_gridnObstacle.at(pt)) {
+        m_gridnObstacle.ref(pt) = nColor;
+        m_distfield.invalidate(pt);
+    }
 }
 
 cv::Mat ObstacleMapWithPoses(cv::Mat const& m, std::vector<rbt::pose<double>> const& vecpose) {
@@ -49,14 +65,43 @@ cv::Mat ObstacleMapWithPoses(cv::Mat const& m, std::vector<rbt::pose<double>> co
     return m;
 }
 
-std::vector<rbt::point<int>> RenderRobotPose(cv::Mat& mat, rbt::pose<double> const& pose, cv::Scalar color) {
+std::vector<rbt::point<int>> RobotPolygon(rbt::pose<double> const& pose) {
     rbt::size<double> const szfHalfSize(c_nRobotWidth/2.0, c_nRobotHeight/2.0);
-    std::vector<rbt::point<int>> vecpt = {
+    return {
         ToGridCoordinate(pose.m_pt - szfHalfSize.rotated(pose.m_fYaw)),
         ToGridCoordinate(pose.m_pt + rbt::size<double>(szfHalfSize.x, -szfHalfSize.y).rotated(pose.m_fYaw)),
         ToGridCoordinate(pose.m_pt + szfHalfSize.rotated(pose.m_fYaw)),
         ToGridCoordinate(pose.m_pt + rbt::size<double>(-szfHalfSize.x, szfHalfSize.y).rotated(pose.m_fYaw))
     };
+}
+
+std::vector<rbt::point<int>> RasterizeConvexPolygon(std::vector<rbt::point<int>> const& rngpt) {
+    // Let OpenCV rasterize the polygon into a small mask that just covers it
+    auto const rectn = [&] {
+        auto rectn = rbt::rect<int>::empty();
+        boost::for_each(rngpt, [&](rbt::point<int> const& pt) { rectn |= pt; });
+        return rectn;
+    }();
+    
+    std::vector<cv::Point> vecpt;
+    boost::for_each(rngpt, [&](rbt::point<int> const& pt) {
+        vecpt.emplace_back(pt.x - rectn.left, pt.y - rectn.bottom);
+    });
+    cv::Mat matnMask = cv::Mat::zeros(rectn.top - rectn.bottom + 1, rectn.right - rectn.left + 1, CV_8UC1);
+    cv::fillConvexPoly(matnMask, vecpt.data(), vecpt.size(), cv::Scalar(255));
+
+    std::vector<rbt::point<int>> vecptResult;
+    for(int y = 0; y < matnMask.rows; ++y) {
+        auto const* pn = matnMask.ptr<std::uint8_t>(y);
+        for(int x = 0; x < matnMask.cols; ++x) {
+            if(pn[x]) vecptResult.emplace_back(x + rectn.left, y + rectn.bottom);
+        }
+    }
+    return vecptResult;
+}
+
+std::vector<rbt::point<int>> RenderRobotPose(cv::Mat& mat, rbt::pose<double> const& pose, cv::Scalar color) {
+    auto vecpt = RobotPolygon(pose);
     cv::fillConvexPoly(mat, reinterpret_cast<cv::Point*>(vecpt.data()), vecpt.size(), color);
     return vecpt;
 }
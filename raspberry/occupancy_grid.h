@@ -3,14 +3,23 @@
 #include "rover.h"
 #include "nonmoveable.h"
 #include "geometry.h"
+#include "tiled_grid.h"
+#include "scanline.h"
+#include "log_odds.h"
+#include "distance_field.h"
 
 #include <boost/range/iterator_range.hpp>
 #include <opencv2/core.hpp>
 
 // An implementation of an occupancy grid, as described e.g. 
 // in Thrun et al, "Probabilistic Robotics"
-template<typename Derived>
+// The log odds are stored in a CTiledGrid, so the map is unbounded and
+// its memory grows with the explored area. TLogOdds is the storage type
+// of the log odds, see SLogOddsTraits.
+template<typename Derived, typename TLogOdds = float>
 struct COccupancyGridBaseT {
+    using log_odds_traits = SLogOddsTraits<TLogOdds>;
+
     COccupancyGridBaseT();        
     COccupancyGridBaseT(COccupancyGridBaseT const& occgrid);
     COccupancyGridBaseT(COccupancyGridBaseT&& occgrid);
@@ -26,32 +35,59 @@ struct COccupancyGridBaseT {
     // are in world coordinates
     void update(rbt::pose<double> const& pose, std::vector<rbt::point<double>> const& vecptf);
 
-    cv::Mat const& LogOddsMap() const { return m_matfMapLogOdds; }
+    // Update the occupancy grid with an entire scan line taken at 'pose'.
+    // Cheaper than updating each scan separately: The robot's footprint is painted
+    // only once and a cell that is crossed by several rays is only marked free once.
+    void update(rbt::pose<double> const& pose, SScanLine const& scanline);
+
+    CTiledGrid<TLogOdds> const& LogOdds() const { return m_gridLogOdds; }
     bool occupied(rbt::point<int> const& pt) const;
+    // true iff pt lies within the mapped area, i.e., the bounding rectangle of all updated cells
     bool is_inside(rbt::point<int> const& pt) const;
+    // Bounding rectangle of all updated cells, rbt::rect<int>::empty() if no cell has been updated
+    rbt::rect<int> const& Bounds() const { return m_rectnBounds; }
 protected:
     void internalUpdatePerObstacle(rbt::point<double> const& ptf, rbt::point<double> const& ptfObstacle);
+    void internalUpdateCell(rbt::point<int> const& pt, double fDeltaValue);
+    // Updates the cn cells pt to pt + (cn-1, 0)
+    void internalUpdateRow(rbt::point<int> const& pt, int cn, double fDeltaValue);
     void internalUpdatePerPose(rbt::pose<double> const& pose);
 
-    cv::Mat m_matfMapLogOdds;
+    CTiledGrid<TLogOdds> m_gridLogOdds;
+    rbt::rect<int> m_rectnBounds;
 };
 
 cv::Mat ObstacleMapWithPoses(cv::Mat const& matn, std::vector<rbt::pose<double>> const& vecpose);
 std::vector<rbt::point<int>> RenderRobotPose(cv::Mat& mat, rbt::pose<double> const& pose, cv::Scalar color);
 
+// The robot's outline as polygon in grid coordinates
+std::vector<rbt::point<int>> RobotPolygon(rbt::pose<double> const& pose);
+// All grid cells covered by the convex polygon rngpt
+std::vector<rbt::point<int>> RasterizeConvexPolygon(std::vector<rbt::point<int>> const& rngpt);
+
 struct COccupancyGrid : COccupancyGridBaseT<COccupancyGrid> {
     COccupancyGrid();        
     COccupancyGrid(COccupancyGrid const& occgrid);
     COccupancyGrid& operator=(COccupancyGrid const& occgrid);
 
-    cv::Mat const& ObstacleMap() const { return m_matnMapObstacle; }
+    // Renders the map window c_rectnMapWindow
+    cv::Mat ObstacleMap() const;
+    cv::Mat ObstacleMap(rbt::rect<int> const& rectn) const;
     cv::Mat ObstacleMapWithPoses(std::vector<rbt::pose<double>> const& vecpose) const;
 
+    // Distance field of the obstacles in ObstacleMap(), valid after UpdateDistanceField()
+    CDistanceField const& DistanceField() const { return m_distfield; }
+    void UpdateDistanceField() { m_distfield.update(m_gridnObstacle); }
+
 private:
     friend struct COccupancyGridBaseT<COccupancyGrid>;
+    // updateGrid only distinguishes positive and non-positive log odds
+    static constexpr double c_fObstacleThreshold = 0;
     void updateGrid(rbt::point<int> const& pt, double fOdds);
     void updateGridPoly(std::vector<rbt::point<int>> const& rngpt, double fOdds);
+    void updateObstacleMap(rbt::point<int> const& pt, std::uint8_t nColor);
 
-    cv::Mat m_matnMapObstacle; // thresholded version of m_matfMapLogOdds
+    CTiledGrid<std::uint8_t> m_gridnObstacle; // thresholded version of m_gridLogOdds
+    CDistanceField m_distfield;
 };
 
@@ -13,90 +13,180 @@
 #include <cstdlib>
 #include <cmath>
 #include <algorithm>
+#include <array>
+#include <cassert>
 
 #include <boost/range/iterator_range.hpp>
 #include <boost/range/size.hpp>
 #include <opencv2/imgproc.hpp>
 
-template<typename Derived>
-COccupancyGridBaseT<Derived>::COccupancyGridBaseT()
-:   m_matfMapLogOdds(c_nMapExtent, c_nMapExtent, CV_32FC1, cv::Scalar(0.0f))
+template<typename Derived, typename TLogOdds>
+COccupancyGridBaseT<Derived, TLogOdds>::COccupancyGridBaseT()
+:   m_gridLogOdds(0), m_rectnBounds(rbt::rect<int>::empty())
 {}
 
-template<typename Derived>
-COccupancyGridBaseT<Derived>::COccupancyGridBaseT(COccupancyGridBaseT<Derived> const& occgrid) 
-:   m_matfMapLogOdds(occgrid.m_matfMapLogOdds.clone())
+template<typename Derived, typename TLogOdds>
+COccupancyGridBaseT<Derived, TLogOdds>::COccupancyGridBaseT(COccupancyGridBaseT<Derived, TLogOdds> const& occgrid) 
+:   m_gridLogOdds(occgrid.m_gridLogOdds), m_rectnBounds(occgrid.m_rectnBounds)
 {}
 
-template<typename Derived>
-COccupancyGridBaseT<Derived>::COccupancyGridBaseT(COccupancyGridBaseT<Derived>&& occgrid) 
-:   m_matfMapLogOdds(occgrid.m_matfMapLogOdds)
+template<typename Derived, typename TLogOdds>
+COccupancyGridBaseT<Derived, TLogOdds>::COccupancyGridBaseT(COccupancyGridBaseT<Derived, TLogOdds>&& occgrid) 
+:   m_gridLogOdds(std::move(occgrid.m_gridLogOdds)), m_rectnBounds(occgrid.m_rectnBounds)
 {}
 
-template<typename Derived>
-COccupancyGridBaseT<Derived>& COccupancyGridBaseT<Derived>::operator=(COccupancyGridBaseT<Derived> const& occgrid) { 
-    m_matfMapLogOdds=occgrid.m_matfMapLogOdds.clone();
+template<typename Derived, typename TLogOdds>
+COccupancyGridBaseT<Derived, TLogOdds>& COccupancyGridBaseT<Derived, TLogOdds>::operator=(COccupancyGridBaseT<Derived, TLogOdds> const& occgrid) { 
+    m_gridLogOdds=occgrid.m_gridLogOdds;
+    m_rectnBounds=occgrid.m_rectnBounds;
     return *this;
 }
 
-template<typename Derived>
-COccupancyGridBaseT<Derived>& COccupancyGridBaseT<Derived>::operator=(COccupancyGridBaseT<Derived>&& occgrid) { 
-    m_matfMapLogOdds=occgrid.m_matfMapLogOdds;
+template<typename Derived, typename TLogOdds>
+COccupancyGridBaseT<Derived, TLogOdds>& COccupancyGridBaseT<Derived, TLogOdds>::operator=(COccupancyGridBaseT<Derived, TLogOdds>&& occgrid) { 
+    m_gridLogOdds=std::move(occgrid.m_gridLogOdds);
+    m_rectnBounds=occgrid.m_rectnBounds;
     return *this;
 }
 
-template<typename Derived>
-bool COccupancyGridBaseT<Derived>::occupied(rbt::point<int> const& pt) const {
-	assert(is_inside(pt));
-    return c_fFreeThreshold<m_matfMapLogOdds.at<float>(pt.y, pt.x);
+template<typename Derived, typename TLogOdds>
+bool COccupancyGridBaseT<Derived, TLogOdds>::occupied(rbt::point<int> const& pt) const {
+    return log_odds_traits::FromDouble(c_fFreeThreshold)<m_gridLogOdds.at(pt);
 }
 
-template<typename Derived>
-bool COccupancyGridBaseT<Derived>::is_inside(rbt::point<int> const& pt) const {
-	auto const sz = m_matfMapLogOdds.size();
-	return 0<=pt.x && 0<=pt.y && pt.x < sz.width && pt.y < sz.height;
+template<typename Derived, typename TLogOdds>
+bool COccupancyGridBaseT<Derived, TLogOdds>::is_inside(rbt::point<int> const& pt) const {
+	return m_rectnBounds.left<=pt.x && m_rectnBounds.bottom<=pt.y 
+        && pt.x<=m_rectnBounds.right && pt.y<=m_rectnBounds.top;
 }
 
-template<typename Derived>
-void COccupancyGridBaseT<Derived>::internalUpdatePerObstacle(rbt::point<double> const& ptf, rbt::point<double> const& ptfObstacle) {
-    cv::LineIterator itpt(
-        m_matfMapLogOdds, 
-        ToGridCoordinate(ptf), 
-        ToGridCoordinate(ptfObstacle)
-    );
-    for(int i = 0; i < itpt.count; i++, ++itpt) {    	
-        auto const pt = rbt::point<int>(itpt.pos());
-        assert(is_inside(pt)); // LineIterator clips to line boundaries
-
-        auto const fDeltaValue = i<itpt.count-1 
-            ? c_fFreeDelta // free
-            : c_fOccupiedDelta; // occupied  
+template<typename Derived, typename TLogOdds>
+void COccupancyGridBaseT<Derived, TLogOdds>::internalUpdatePerObstacle(rbt::point<double> const& ptf, rbt::point<double> const& ptfObstacle) {
+    auto const ptnObstacle = ToGridCoordinate(ptfObstacle);
+    rbt::for_each_line_point(ToGridCoordinate(ptf), ptnObstacle, [&](rbt::point<int> const& pt) {
+        internalUpdateCell(
+            pt,
+            pt!=ptnObstacle
+                ? c_fFreeDelta // free
+                : c_fOccupiedDelta // occupied  
+        );
+    });
+}
 
-        auto const fOdds = m_matfMapLogOdds.at<float>(pt.y, pt.x) + fDeltaValue;
-        m_matfMapLogOdds.at<float>(pt.y, pt.x) = fOdds;
+template<typename Derived, typename TLogOdds>
+void COccupancyGridBaseT<Derived, TLogOdds>::internalUpdateCell(rbt::point<int> const& pt, double fDeltaValue) {
+    auto& tOdds = m_gridLogOdds.ref(pt);
+    tOdds = log_odds_traits::Add(tOdds, log_odds_traits::FromDouble(fDeltaValue));
+    m_rectnBounds |= pt;
 
-        static_cast<Derived*>(this)->updateGrid(pt, fOdds);	
-    }
+    static_cast<Derived*>(this)->updateGrid(pt, log_odds_traits::ToDouble(tOdds));	
 }
 
-template<typename Derived>
-void COccupancyGridBaseT<Derived>::internalUpdatePerPose(rbt::pose<double> const& pose) {
-    static_cast<Derived*>(this)->updateGridPoly(
-    	RenderRobotPose(m_matfMapLogOdds, pose, cv::Scalar(c_fOccupancyRover)), 
-    	c_fOccupiedDelta
-    );
+template<typename Derived, typename TLogOdds>
+void COccupancyGridBaseT<Derived, TLogOdds>::internalUpdateRow(rbt::point<int> const& pt, int cn, double fDeltaValue) {
+    auto const tDelta = log_odds_traits::FromDouble(fDeltaValue);
+    // updateGrid only depends on the thresholded log odds, so it is only
+    // called for the cells whose state changed. The segments lie within a tile.
+    auto const tThreshold = log_odds_traits::FromDouble(Derived::c_fObstacleThreshold);
+    std::array<std::uint8_t, c_nTileExtent> anStateBefore;
+    std::array<std::uint8_t, c_nTileExtent> anStateAfter;
+    std::array<int, c_nTileExtent> anChanged;
+    m_gridLogOdds.ModifyRow(pt, cn, [&](rbt::point<int> const& ptBegin, TLogOdds* ptOdds, int cnSegment) {
+        ASSERT(cnSegment<=c_nTileExtent);
+        // all vectorized
+        ThresholdLogOdds(ptOdds, anStateBefore.data(), cnSegment, tThreshold);
+        AddLogOdds(ptOdds, cnSegment, tDelta);
+        ThresholdLogOdds(ptOdds, anStateAfter.data(), cnSegment, tThreshold);
+        auto const cChanged = FindChangedCells(anStateBefore.data(), anStateAfter.data(), cnSegment, anChanged.data());
+        for(int i = 0; i<cChanged; ++i) {
+            static_cast<Derived*>(this)->updateGrid(
+                ptBegin + rbt::size<int>(anChanged[i], 0), 
+                log_odds_traits::ToDouble(ptOdds[anChanged[i]])
+            );
+        }
+    });
+    m_rectnBounds |= pt;
+    m_rectnBounds |= pt + rbt::size<int>(cn-1, 0);
 }
 
-template<typename Derived>
-void COccupancyGridBaseT<Derived>::update(rbt::pose<double> const& pose, double fRadAngle, int nDistance) {
+template<typename Derived, typename TLogOdds>
+void COccupancyGridBaseT<Derived, TLogOdds>::internalUpdatePerPose(rbt::pose<double> const& pose) {
+    auto const vecptPolygon = RobotPolygon(pose);
+    boost::for_each(RasterizeConvexPolygon(vecptPolygon), [&](rbt::point<int> const& pt) {
+        m_gridLogOdds.ref(pt) = log_odds_traits::FromDouble(c_fOccupancyRover);
+        m_rectnBounds |= pt;
+    });
+    static_cast<Derived*>(this)->updateGridPoly(vecptPolygon, c_fOccupiedDelta);
+}
+template<typename Derived, typename TLogOdds>
+void COccupancyGridBaseT<Derived, TLogOdds>::update(rbt::pose<double> const& pose, double fRadAngle, int nDistance) {
     internalUpdatePerObstacle(pose.m_pt, Obstacle(pose, fRadAngle, nDistance));
     internalUpdatePerPose(pose);
 }
 
-template<typename Derived>
-void COccupancyGridBaseT<Derived>::update(rbt::pose<double> const& pose, std::vector<rbt::point<double>> const& vecptf) {
+template<typename Derived, typename TLogOdds>
+void COccupancyGridBaseT<Derived, TLogOdds>::update(rbt::pose<double> const& pose, std::vector<rbt::point<double>> const& vecptf) {
     boost::for_each(vecptf, [&](auto const& ptf) {
         internalUpdatePerObstacle(pose.m_pt, ptf);
     });
     internalUpdatePerPose(pose);
 }
+
+template<typename Derived, typename TLogOdds>
+void COccupancyGridBaseT<Derived, TLogOdds>::update(rbt::pose<double> const& pose, SScanLine const& scanline) {
+    if(scanline.m_vecscan.empty()) return;
+
+    auto const ptnPose = ToGridCoordinate(pose.m_pt);
+    std::vector<rbt::point<int>> vecptOccupied;
+    vecptOccupied.reserve(scanline.m_vecscan.size());
+    
+    auto rectn = rbt::rect<int>::bound({ptnPose});
+    boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
+        vecptOccupied.emplace_back(ToGridCoordinate(Obstacle(pose, scan.m_fRadAngle, scan.m_nDistance)));
+        rectn |= vecptOccupied.back();
+    });
+
+    // Mark every cell touched by this scan once in a scratch bitmap covering
+    // the scan's bounding box. Cells hit by any ray are never marked free.
+    enum EMark : std::uint8_t { emarkUNTOUCHED, emarkFREE, emarkOCCUPIED };
+    auto const nWidth = rectn.right - rectn.left + 1;
+    std::vector<std::uint8_t> vecnMark((rectn.top - rectn.bottom + 1) * nWidth, emarkUNTOUCHED);
+    auto Mark = [&](rbt::point<int> const& pt) -> std::uint8_t& {
+        return vecnMark[(pt.y - rectn.bottom) * nWidth + (pt.x - rectn.left)];
+    };
+
+    vecptOccupied.erase(
+        std::remove_if(vecptOccupied.begin(), vecptOccupied.end(), [&](rbt::point<int> const& pt) {
+            if(emarkOCCUPIED==Mark(pt)) return true; // duplicate
+            Mark(pt) = emarkOCCUPIED;
+            return false;
+        }),
+        vecptOccupied.end()
+    );
+
+    boost::for_each(vecptOccupied, [&](rbt::point<int> const& ptnObstacle) {
+        rbt::for_each_line_point(ptnPose, ptnObstacle, [&](rbt::point<int> const& pt) {
+            if(emarkUNTOUCHED==Mark(pt)) Mark(pt) = emarkFREE;
+        });
+    });
+
+    // The free cells of neighboring rays mostly form contiguous rows,
+    // update them row by row so the log odds can be updated with SIMD instructions
+    for(int y = rectn.bottom; y <= rectn.top; ++y) {
+        auto const itnRow = vecnMark.begin() + (y - rectn.bottom) * nWidth;
+        auto itnBegin = std::find(itnRow, itnRow + nWidth, emarkFREE);
+        while(itnBegin != itnRow + nWidth) {
+            auto const itnEnd = std::find_if(itnBegin, itnRow + nWidth, [](std::uint8_t n) { return emarkFREE!=n; });
+            internalUpdateRow(
+                rbt::point<int>(rectn.left + static_cast<int>(itnBegin - itnRow), y),
+                static_cast<int>(itnEnd - itnBegin),
+                c_fFreeDelta
+            );
+            itnBegin = std::find(itnEnd, itnRow + nWidth, emarkFREE);
+        }
+    }
+    boost::for_each(vecptOccupied, [&](rbt::point<int> const& pt) {
+        internalUpdateCell(pt, c_fOccupiedDelta);
+    });
+    internalUpdatePerPose(pose);
+}
@@ -2,6 +2,8 @@
 #include "rover.h"
 #include "robot_configuration.h"
 #include "fast_particle_slam.h"
+#include "monte_carlo_localization.h"
+#include "pose_graph_slam.h"
 #include "path_finding.h"
 
 #include <stdio.h>
@@ -15,7 +17,12 @@
 #include <opencv2/imgcodecs/imgcodecs.hpp>     // cv::imread()
 #include <opencv2/opencv.hpp>
 
-int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> const& ostrOutput) {
+namespace {
+// TLocalization is CFastParticleSlamBase, CMonteCarloLocalization or CPoseGraphSlam
+template<typename TLocalization>
+int ParseLogFileT(TLocalization& pfslam, std::ifstream& ifs, bool bVideo, boost::optional<std::string> const& ostrOutput, 
+    boost::optional<std::string> const& ostrLoadMap, boost::optional<std::string> const& ostrSaveMap, bool bRelocalize
+) {
 
     cv::VideoWriter vid;
     
@@ -30,7 +37,7 @@ int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> c
     
     auto const tpStart = std::chrono::system_clock::now();
 
-    CFastParticleSlamBase pfslam;
+    if(ostrLoadMap && !pfslam.LoadMap(ostrLoadMap.get(), bRelocalize)) return 1;
     SScanLine scanline;
     
     SOdometryData odomPrev = {0};
@@ -100,8 +107,7 @@ int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> c
                     }
                     scanline.m_vecscan = std::move(vecscan);
 
-                    if(scanline.translation()!=rbt::size<double>::zero() || scanline.rotation()!=0.0) {
-                        pfslam.receivedSensorData(scanline);
+                    if(pfslam.receivedSensorData(scanline)) {
                         if(vid.isOpened()) {
                             cv::Mat matTemp;
                             cv::cvtColor(pfslam.getMapWithPoses(), matTemp, cv::COLOR_GRAY2RGB);
@@ -118,6 +124,8 @@ int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> c
         }
     }
 
+    if(ostrSaveMap && !pfslam.SaveMap(ostrSaveMap.get())) return 1;
+
     if(!bVideo && ostrOutput) {
         try {
             cv::imwrite(ostrOutput.get() + ".png", pfslam.getMap());
@@ -141,7 +149,7 @@ int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> c
 
     {
         auto const tpStart = std::chrono::system_clock::now();
-        auto const vecptf = FindPath(pfslam.getMap(), poseFinal, rbt::point<double>::zero());
+        auto const vecptf = FindPath(pfslam.getMapPyramid(), poseFinal, rbt::point<double>::zero());
         auto const tpEnd = std::chrono::system_clock::now();
     
         std::chrono::duration<double> const durDiff = tpEnd-tpStart;
@@ -160,6 +168,7 @@ int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> c
         }
     }
     {
+        auto const matn = pfslam.getMap();
         auto const tpStart = std::chrono::system_clock::now();
         auto const vecposeConfigSpace = PathConfigurationSpace(matn, poseFinal, rbt::point<double>::zero());
         auto const tpEnd = std::chrono::system_clock::now();
@@ -179,3 +188,19 @@ int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> c
     }
     return 0;
 }
+}
+
+int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> const& ostrOutput, 
+    boost::optional<std::string> const& ostrLoadMap, boost::optional<std::string> const& ostrSaveMap, bool bLocalize, bool bPoseGraph, bool bRelocalize
+) {
+    if(bLocalize) {
+        CMonteCarloLocalization mcl;
+        return ParseLogFileT(mcl, ifs, bVideo, ostrOutput, ostrLoadMap, ostrSaveMap, bRelocalize);
+    } else if(bPoseGraph) {
+        CPoseGraphSlam pgslam;
+        return ParseLogFileT(pgslam, ifs, bVideo, ostrOutput, ostrLoadMap, ostrSaveMap, bRelocalize);
+    } else {
+        CFastParticleSlamBase pfslam;
+        return ParseLogFileT(pfslam, ifs, bVideo, ostrOutput, ostrLoadMap, ostrSaveMap, bRelocalize);
+    }
+}
@@ -2,6 +2,8 @@
 #include "robot_configuration.h"
 #include "error_handling.h"
 #include "occupancy_grid.inl"
+#include "thread_pool.h"
+#include "random_generator.h"
 
 #include <boost/range/algorithm/max_element.hpp>
 #include <boost/range/adaptor/transformed.hpp>
@@ -9,44 +11,21 @@
 #include <opencv2/imgproc.hpp>
 #include <iostream>
 #include <random>
-#include <future>
 
 /////////////////////
 // SParticle
 SParticle::SParticle() 
-    : m_pose(rbt::pose<double>::zero()),
-    m_matLikelihood(c_nMapExtent, c_nMapExtent, CV_32FC1, cv::Scalar(0))
+    : m_pose(rbt::pose<double>::zero())
 {}
 
-SParticle::SParticle(SParticle const& p)
-    : m_pose(p.m_pose),
-     m_matLikelihood(p.m_matLikelihood.clone()),
-     m_occgrid(p.m_occgrid)
-{}
-
-SParticle& SParticle::operator=(SParticle const& p) {
-    m_pose = p.m_pose;
-    m_matLikelihood = p.m_matLikelihood.clone();
-    m_occgrid = p.m_occgrid;
-    return *this;
-}
-
-void SParticle::update(SScanLine const& scanline) {
+void SParticle::update(SScanLine const& scanline, SScanLine const& scanlineMatch) {
     m_pose = sample_motion_model(m_pose, scanline.translation(), scanline.rotation());
 
-    // OPTIMIZE: Match fewer points
-    m_fWeight = measurement_model_map(m_pose, scanline, 
-        [this](rbt::point<double> const& pt) {
-            auto const ptn = ToGridCoordinate(pt);
-            return static_cast<double>(m_matLikelihood.at<float>(ptn.y, ptn.x));
-        });
+    m_fWeight = measurement_model_map(m_pose, scanlineMatch, m_occgrid.DistanceField());
 
     // OPTIMIZE: Recalculate occupancy grid after resampling?
-    // OPTIMIZE: m_occgrid.update also sets occupancy of robot itself each time
-    boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
-        m_occgrid.update(m_pose, scan.m_fRadAngle, scan.m_nDistance);
-    });
-    cv::distanceTransform(m_occgrid.ObstacleMap(), m_matLikelihood, CV_DIST_L2, 3); 
+    m_occgrid.update(m_pose, scanline);
+    m_occgrid.UpdateDistanceField(); 
 }
 
 ///////////////////////
@@ -55,7 +34,6 @@ CParticleSlamBase::CParticleSlamBase(int cParticles)
     : m_vecparticle(cParticles), m_itparticleBest(m_vecparticle.end()), m_vecparticleTemp(cParticles) 
 {}
 
-static std::random_device s_rd;
 void CParticleSlamBase::receivedSensorData(SScanLine const& scanline) {
     // TODO: Ignore data when robot is not moving for a long time
     
@@ -65,20 +43,15 @@ void CParticleSlamBase::receivedSensorData(SScanLine const& scanline) {
         ";" << scanline.translation().y << ") "
         "r = " << scanline.rotation());
 
-    std::vector<std::future<double>> vecfuture;
-    boost::for_each(m_vecparticle, [&](SParticle& p) {
-        vecfuture.emplace_back( 
-            std::async(std::launch::async | std::launch::deferred,
-                [&] {
-                    p.update(scanline);
-                    return p.m_fWeight;
-                }
-            ));
-    }); 
+    auto const scanlineMatch = scanline.downsampled();
+    ThreadPool().parallel_for(m_vecparticle.size(), [&](std::size_t i) {
+        SeedRandomGenerator(m_vecpose.size(), i);
+        m_vecparticle[i].update(scanline, scanlineMatch);
+    });
 
     double fWeightTotal = 0.0;
-    for(int i=0; i<vecfuture.size(); ++i) {
-        fWeightTotal += vecfuture[i].get();
+    for(int i=0; i<m_vecparticle.size(); ++i) {
+        fWeightTotal += m_vecparticle[i].m_fWeight;
 
 #ifdef ENABLE_LOG
         auto const& p = m_vecparticle[i];
@@ -92,7 +65,9 @@ void CParticleSlamBase::receivedSensorData(SScanLine const& scanline) {
     // Resampling
     // Thrun, Probabilistic robotics, p. 110
     auto const fStepSize = fWeightTotal/m_vecparticle.size();
-    auto const r = std::uniform_real_distribution<double>(0.0, fStepSize)(s_rd);
+    // Key differs from all particle tasks, the thread may have run any of them
+    SeedRandomGenerator(m_vecpose.size(), m_vecparticle.size());
+    auto const r = std::uniform_real_distribution<double>(0.0, fStepSize)(RandomGenerator());
     auto c = m_vecparticle.front().m_fWeight;
 
     auto itparticleOut = m_vecparticleTemp.begin();
@@ -13,15 +13,13 @@ struct SParticle {
     rbt::pose<double> m_pose;
     
     double m_fWeight;
-    cv::Mat m_matLikelihood; // likelihood field
     
     COccupancyGrid m_occgrid;
     
     SParticle();
-    SParticle(SParticle const& p);
-    SParticle& operator=(SParticle const& p);
 
-    void update(SScanLine const& scanline);
+    // Scores scanlineMatch, a downsampled copy of scanline, and updates the map with scanline
+    void update(SScanLine const& scanline, SScanLine const& scanlineMatch);
 };
 
 struct CParticleSlamBase : rbt::nonmoveable {
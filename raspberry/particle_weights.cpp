@@ -0,0 +1,44 @@
+#include "particle_weights.h"
+#include "error_handling.h"
+
+#include <cassert>
+#include <opencv2/core.hpp>
+
+double NormalizeLogWeights(std::vector<double> const& vecfLogWeight, double fGain, std::vector<double>& vecfWeight) {
+    ASSERT(!vecfLogWeight.empty());
+    vecfWeight.resize(vecfLogWeight.size());
+
+    // Headers without copies, OpenCV's element-wise operations are vectorized
+    auto const nSize = static_cast<int>(vecfLogWeight.size());
+    cv::Mat const matfLogWeight(1, nSize, CV_64FC1, const_cast<double*>(vecfLogWeight.data()));
+    cv::Mat matfWeight(1, nSize, CV_64FC1, vecfWeight.data());
+
+    double fMax;
+    cv::minMaxLoc(matfLogWeight, nullptr, &fMax);
+    matfLogWeight.convertTo(matfWeight, CV_64F, fGain, -fGain * fMax);
+    cv::exp(matfWeight, matfWeight);
+    matfWeight *= 1.0 / cv::sum(matfWeight)[0];
+
+    return 1.0 / matfWeight.dot(matfWeight);
+}
+
+std::vector<int> SystematicResample(std::vector<double> const& vecfWeight, std::size_t c, double fRandom) {
+    ASSERT(!vecfWeight.empty());
+    auto const fStepSize = 1.0/c;
+    auto const r = fRandom * fStepSize;
+    auto fSum = vecfWeight.front();
+
+    std::vector<int> veciparticle;
+    veciparticle.reserve(c);
+    int i = 0;
+    for(std::size_t m = 0; m<c; ++m) {
+        auto const u = r + m * fStepSize;
+        // Rounding errors may leave the sum of all weights slightly below u
+        while(fSum<u && i+1<static_cast<int>(vecfWeight.size())) {
+            ++i;
+            fSum += vecfWeight[i];
+        }
+        veciparticle.emplace_back(i);
+    }
+    return veciparticle;
+}
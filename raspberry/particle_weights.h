@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Weight computations of the particle filters on contiguous arrays of weights
+
+// Normalizes the weights exp(fGain * fLogWeight) and writes them to vecfWeight. 
+// Subtracts the maximum log weight first, i.e., computes the log-sum-exp without overflow.
+// Returns the effective sample size 1 / sum(w^2).
+double NormalizeLogWeights(std::vector<double> const& vecfLogWeight, double fGain, std::vector<double>& vecfWeight);
+
+// Systematic resampling, Thrun, Probabilistic robotics, p. 110
+// Draws c particles according to the normalized weights vecfWeight using a single
+// random number fRandom in [0, 1). Returns the sorted indices of the drawn particles.
+std::vector<int> SystematicResample(std::vector<double> const& vecfWeight, std::size_t c, double fRandom);
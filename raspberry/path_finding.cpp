@@ -4,6 +4,7 @@
 #include "rover.h"
 #include "geometry.h"
 #include "robot_configuration.h"
+#include "grid_pyramid.h"
 
 #include <opencv2/opencv.hpp>
 
@@ -52,81 +53,162 @@ boost::optional<TNode> GenericAStar(rbt::pose<T> const& poseStart,
     return boost::none;
 }
 
-std::vector<rbt::point<double>> FindPath(cv::Mat matn, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd) {
-    cv::Mat matnEroded;
-    auto const nMaxExtent = std::max(c_nRobotWidth/c_nScale, c_nRobotHeight/c_nScale);
-    cv::erode(
-        matn, 
-        matnEroded, 
-        cv::Mat::ones(nMaxExtent, nMaxExtent, CV_8U)
-    );
-    
-    // Include costs of traveling close to an obstacle in calculation
-    cv::Mat matnGauss;
-    auto const nMaxExtentOdd = 2*nMaxExtent + 1;
-    cv::GaussianBlur(matnEroded, matnGauss, cv::Size(nMaxExtentOdd, nMaxExtentOdd), 0, 0);
+namespace {
+    // Path finding costs on pyramid level nLevel: Obstacles are grown by the robot's extent
+    // and traveling close to an obstacle is more expensive
+    cv::Mat TraversabilityMap(cv::Mat const& matn, int nLevel) {
+        cv::Mat matnEroded;
+        auto const nMaxExtent = std::max(1, std::max(c_nRobotWidth/c_nScale, c_nRobotHeight/c_nScale) >> nLevel);
+        cv::erode(
+            matn, 
+            matnEroded, 
+            cv::Mat::ones(nMaxExtent, nMaxExtent, CV_8U)
+        );
+        
+        // Include costs of traveling close to an obstacle in calculation
+        cv::Mat matnGauss;
+        auto const nMaxExtentOdd = 2*nMaxExtent + 1;
+        cv::GaussianBlur(matnEroded, matnGauss, cv::Size(nMaxExtentOdd, nMaxExtentOdd), 0, 0);
+        return matnGauss;
+    }
 
-    float aanMinimalCost[c_nMapExtent][c_nMapExtent];
-    std::fill_n(&aanMinimalCost[0][0], c_nMapExtent*c_nMapExtent, std::numeric_limits<float>::max());
+    // A* path finding on the traversability map matnGauss. If matnCorridor is not empty,
+    // only its non-zero cells are searched. Returns the path from ptnEnd back to 
+    // posenStart.m_pt or an empty path, also if start or end are outside of matnGauss.
+    std::vector<rbt::point<int>> FindPathOnLevel(cv::Mat const& matnGauss, cv::Mat const& matnCorridor, rbt::pose<int> const& posenStart, rbt::point<int> const& ptnEnd) {
+        // The map is unbounded, but only the rendered window is searched
+        auto Inside = [&](rbt::point<int> const& pt) {
+            return 0<=pt.x && pt.x<matnGauss.cols && 0<=pt.y && pt.y<matnGauss.rows;
+        };
+        if(!Inside(posenStart.m_pt) || !Inside(ptnEnd)) return {};
+
+        cv::Mat_<float> matfMinimalCost(matnGauss.rows, matnGauss.cols, std::numeric_limits<float>::max());
+
+        struct node {
+            node() {}
+            node(rbt::pose<int> const& pose) : m_pt(pose.m_pt), m_fCost(0) {}
+            node(rbt::point<int> const& pt, float fCost) : m_pt(pt), m_fCost(fCost) {}
+
+            rbt::point<int> Position() const { return m_pt; }
+
+            rbt::point<int> m_pt; // in grid coordinates
+            float m_fCost;
+        };
+
+        auto MinimalNodeCost = [&](node const& node) noexcept -> float& {
+            return matfMinimalCost(node.m_pt.y, node.m_pt.x);
+        };
+
+        auto ForEachNeighbor = [&](node const& n, auto fn) noexcept {
+            for(int x = -1; x <= 1; ++x) {
+                for(int y = -1; y <= 1; ++y) {
+                    auto const ptNext = n.m_pt + rbt::size<int>(x, y);
+                    if((0!=x || 0!=y)
+                    && Inside(ptNext)
+                    && (matnCorridor.empty() || 0!=matnCorridor.at<std::uint8_t>(ptNext.y, ptNext.x))
+                    && 128<matnGauss.at<std::uint8_t>(ptNext.y, ptNext.x)) {
+                        fn(node(
+                            ptNext,
+                            n.m_fCost + (0==x || 0==y ? 1.0f : M_SQRT2) * (1 + (255 - matnGauss.at<std::uint8_t>(ptNext.y, ptNext.x))/10)
+                        ));
+                    }
+                }
+            }
+        };
+        auto IsGoal = [](node const& n, rbt::point<int> const& ptnEnd) {
+            return n.m_pt == ptnEnd;
+        };
+
+        std::vector<rbt::point<int>> vecptnResult;
+        if(auto onode = GenericAStar<node>(posenStart, ptnEnd, MinimalNodeCost, ForEachNeighbor, IsGoal)) {
+            vecptnResult.emplace_back(onode->m_pt);
+            auto const ptnStart = posenStart.m_pt;
+            for(auto nodePrev = *onode; nodePrev.m_pt!=ptnStart; ) {
+                float fMinCost = std::numeric_limits<float>::max();
+                node nodeMin;
+                ForEachNeighbor(
+                    nodePrev,
+                    [&](node const& node) {
+                        if(rbt::assign_min(fMinCost, MinimalNodeCost(node))) {
+                            nodeMin = node;
+                        }
+                    }
+                );
 
-    struct node {
-        node() {}
-        node(rbt::pose<int> const& pose) : m_pt(pose.m_pt), m_fCost(0) {}
-        node(rbt::point<int> const& pt, float fCost) : m_pt(pt), m_fCost(fCost) {}
+                nodePrev = nodeMin;
+                vecptnResult.emplace_back(nodeMin.m_pt);
+            }
+        }
+        return vecptnResult;
+    }
 
-		rbt::point<int> Position() const { return m_pt; }
+    // Cells within a few coarse cells of the path vecptnCoarse, in coordinates of the next finer level
+    cv::Mat Corridor(std::vector<rbt::point<int>> const& vecptnCoarse, cv::Size const& sz) {
+        int constexpr c_nCorridorRadius = 2; // coarse cells
+        cv::Mat matnCorridor = cv::Mat::zeros(sz, CV_8U);
+        auto ToFine = [](rbt::point<int> const& pt) { return pt * 2 + rbt::size<int>(1, 1); };
+        rbt::point<int> ptnPrev = ToFine(vecptnCoarse.front());
+        boost::for_each(vecptnCoarse, [&](rbt::point<int> const& ptn) {
+            cv::line(matnCorridor, ptnPrev, ToFine(ptn), cv::Scalar(255), 2*(2*c_nCorridorRadius) + 1);
+            ptnPrev = ToFine(ptn);
+        });
+        return matnCorridor;
+    }
+}
 
-        rbt::point<int> m_pt; // in grid coordinates
-        float m_fCost;
+std::vector<rbt::point<double>> FindPath(std::vector<cv::Mat> const& vecmatnPyramid, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd) {
+    ASSERT(!vecmatnPyramid.empty());
+    auto const posenStart = ToGridCoordinate(posefStart);
+    auto const ptnEnd = ToGridCoordinate(ptfEnd);
+
+    auto FindPathOn = [&](int nLevel, cv::Mat const& matnCorridor) {
+        return FindPathOnLevel(
+            TraversabilityMap(vecmatnPyramid[nLevel], nLevel), 
+            matnCorridor,
+            rbt::pose<int>(PyramidLevelCoordinate(posenStart.m_pt, nLevel), posenStart.m_fYaw),
+            PyramidLevelCoordinate(ptnEnd, nLevel)
+        );
     };
 
-    auto MinimalNodeCost = [&](node const& node) noexcept -> float& {
-        return aanMinimalCost[node.m_pt.x][node.m_pt.y];
-    };
+    // Find a path on the coarsest level that has one. Coarse cells containing any
+    // obstacle or unknown cell are blocked, so narrow passages may only be found at 
+    // finer levels or at full resolution.
+    std::vector<rbt::point<int>> vecptnPath;
+    int nLevel = static_cast<int>(vecmatnPyramid.size()) - 1;
+    for(; 0<nLevel && vecptnPath.empty(); --nLevel) {
+        vecptnPath = FindPathOn(nLevel, cv::Mat());
+    }
 
-    auto ForEachNeighbor = [&](node const& n, auto fn) noexcept {
-        for(int x = -1; x <= 1; ++x) {
-            for(int y = -1; y <= 1; ++y) {
-                auto const ptNext = n.m_pt + rbt::size<int>(x, y);
-                if((0!=x || 0!=y)
-                && 128<matnGauss.at<std::uint8_t>(ptNext.y, ptNext.x)) {
-                    fn(node(
-                        ptNext,
-                        n.m_fCost + (0==x || 0==y ? 1.0f : M_SQRT2) * (1 + (255 - matnGauss.at<std::uint8_t>(ptNext.y, ptNext.x))/10)
-                    ));
-                }
-            }
+    // Refine the path level by level in a corridor around the coarser path
+    for(; 0<=nLevel; --nLevel) {
+        auto const matnCorridor = vecptnPath.empty() 
+            ? cv::Mat()
+            : Corridor(vecptnPath, vecmatnPyramid[nLevel].size());
+        auto vecptnRefined = FindPathOn(nLevel, matnCorridor);
+        if(vecptnRefined.empty() && !matnCorridor.empty()) {
+            vecptnRefined = FindPathOn(nLevel, cv::Mat());
         }
-    };
-	auto IsGoal = [](node const& n, rbt::point<int> const& ptnEnd) {
-		return n.m_pt == ptnEnd;
-	};
-
-	auto const posenStart = ToGridCoordinate(posefStart);
+        vecptnPath = std::move(vecptnRefined);
+    }
 
     std::vector<rbt::point<double>> vecptfResult;
-    if(auto onode = GenericAStar<node>(posenStart, ToGridCoordinate(ptfEnd), MinimalNodeCost, ForEachNeighbor, IsGoal)) {
+    if(!vecptnPath.empty()) {
         vecptfResult.emplace_back(ptfEnd);
-        auto const ptnStart = posenStart.m_pt;
-        for(auto nodePrev = *onode; nodePrev.m_pt!=ptnStart; ) {
-            float fMinCost = std::numeric_limits<float>::max();
-            node nodeMin;
-            ForEachNeighbor(
-                nodePrev,
-                [&](node const& node) {
-                    if(rbt::assign_min(fMinCost, MinimalNodeCost(node))) {
-                        nodeMin = node;
-                    }
-                }
-            );
-
-            nodePrev = nodeMin;
-            vecptfResult.emplace_back(ToWorldCoordinate(rbt::point<double>(nodeMin.m_pt)));
-        }
+        std::for_each(std::next(vecptnPath.begin()), vecptnPath.end(), [&](rbt::point<int> const& ptn) {
+            vecptfResult.emplace_back(ToWorldCoordinate(rbt::point<double>(ptn)));
+        });
     }
     return vecptfResult;
 }
 
+std::vector<rbt::point<double>> FindPath(cv::Mat matn, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd) {
+    std::vector<cv::Mat> vecmatnPyramid{matn};
+    for(int nLevel = 1; nLevel<=c_nPyramidLevels; ++nLevel) {
+        vecmatnPyramid.emplace_back(MinPool2x2<std::uint8_t>(vecmatnPyramid.back(), 128));
+    }
+    return FindPath(vecmatnPyramid, posefStart, ptfEnd);
+}
+
 
 namespace {
     struct config_space_node {
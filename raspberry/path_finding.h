@@ -3,4 +3,6 @@
 #include <vector>
 
 std::vector<rbt::point<double>> FindPath(cv::Mat matn, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd);
+// Coarse-to-fine path finding on a map pyramid as returned by CFastParticleSlamBase::getMapPyramid()
+std::vector<rbt::point<double>> FindPath(std::vector<cv::Mat> const& vecmatnPyramid, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd);
 std::vector<rbt::pose<double>> PathConfigurationSpace(cv::Mat matn, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd);
\ No newline at end of file
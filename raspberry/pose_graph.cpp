@@ -0,0 +1,222 @@
+#include "pose_graph.h"
+#include "error_handling.h"
+
+#include <boost/range/algorithm/for_each.hpp>
+#include <boost/range/algorithm/find_if.hpp>
+
+#include <cassert>
+#include <cmath>
+#include <utility>
+
+rbt::pose<double> ComposePose(rbt::pose<double> const& pose, rbt::pose<double> const& poseRelative) {
+    return rbt::pose<double>(
+        pose.m_pt + rbt::size<double>(poseRelative.m_pt).rotated(pose.m_fYaw),
+        pose.m_fYaw + poseRelative.m_fYaw
+    );
+}
+
+rbt::pose<double> RelativePose(rbt::pose<double> const& poseFrom, rbt::pose<double> const& poseTo) {
+    return rbt::pose<double>(
+        rbt::point<double>::zero() + (poseTo.m_pt - poseFrom.m_pt).rotated(-poseFrom.m_fYaw),
+        std::remainder(poseTo.m_fYaw - poseFrom.m_fYaw, 2*M_PI)
+    );
+}
+
+namespace {
+    using TBlock = std::array<double, 9>; // 3x3, row major
+    using TVector = std::array<double, 3>;
+
+    void Add(TBlock& block, TBlock const& blockOther) {
+        for(int i = 0; i < 9; ++i) block[i] += blockOther[i];
+    }
+
+    // lhs^T * diag(afInformation) * rhs
+    TBlock WeightedProduct(TBlock const& lhs, TVector const& afInformation, TBlock const& rhs) {
+        TBlock block{};
+        for(int r = 0; r < 3; ++r) {
+            for(int c = 0; c < 3; ++c) {
+                for(int k = 0; k < 3; ++k) block[3*r + c] += lhs[3*k + r] * afInformation[k] * rhs[3*k + c];
+            }
+        }
+        return block;
+    }
+
+    // lhs^T * diag(afInformation) * v
+    TVector WeightedProduct(TBlock const& lhs, TVector const& afInformation, TVector const& v) {
+        TVector vResult{};
+        for(int r = 0; r < 3; ++r) {
+            for(int k = 0; k < 3; ++k) vResult[r] += lhs[3*k + r] * afInformation[k] * v[k];
+        }
+        return vResult;
+    }
+
+    TVector Multiply(TBlock const& block, TVector const& v) {
+        return {{
+            block[0]*v[0] + block[1]*v[1] + block[2]*v[2],
+            block[3]*v[0] + block[4]*v[1] + block[5]*v[2],
+            block[6]*v[0] + block[7]*v[1] + block[8]*v[2]
+        }};
+    }
+
+    TBlock Inverse(TBlock const& block) {
+        TBlock const blockCofactor{{
+            block[4]*block[8] - block[5]*block[7], block[2]*block[7] - block[1]*block[8], block[1]*block[5] - block[2]*block[4],
+            block[5]*block[6] - block[3]*block[8], block[0]*block[8] - block[2]*block[6], block[2]*block[3] - block[0]*block[5],
+            block[3]*block[7] - block[4]*block[6], block[1]*block[6] - block[0]*block[7], block[0]*block[4] - block[1]*block[3]
+        }};
+        double const fDeterminant = block[0]*blockCofactor[0] + block[1]*blockCofactor[3] + block[2]*blockCofactor[6];
+        ASSERT(0 < fDeterminant); // diagonal blocks of the normal equations are positive definite
+        TBlock blockInverse;
+        for(int i = 0; i < 9; ++i) blockInverse[i] = blockCofactor[i] / fDeterminant;
+        return blockInverse;
+    }
+
+    double Dot(std::vector<TVector> const& vecvLhs, std::vector<TVector> const& vecvRhs) {
+        double f = 0;
+        for(std::size_t i = 0; i < vecvLhs.size(); ++i) {
+            for(int k = 0; k < 3; ++k) f += vecvLhs[i][k] * vecvRhs[i][k];
+        }
+        return f;
+    }
+
+    // Square matrix of 3x3 blocks. Row i stores the diagonal block first,
+    // followed by the blocks of all nodes connected to node i.
+    struct CSparseBlockMatrix {
+        explicit CSparseBlockMatrix(std::size_t cRows) : m_vecvecpairblock(cRows) {
+            for(std::size_t i = 0; i < cRows; ++i) m_vecvecpairblock[i].emplace_back(i, TBlock{});
+        }
+
+        TBlock& at(std::size_t i, std::size_t j) {
+            auto& vecpairblock = m_vecvecpairblock[i];
+            auto const itpairblock = boost::find_if(vecpairblock, [&](std::pair<std::size_t, TBlock> const& pairblock) {
+                return pairblock.first==j;
+            });
+            if(vecpairblock.end()!=itpairblock) return itpairblock->second;
+            vecpairblock.emplace_back(j, TBlock{});
+            return vecpairblock.back().second;
+        }
+
+        TBlock const& diagonal(std::size_t i) const { return m_vecvecpairblock[i].front().second; }
+
+        std::vector<TVector> operator*(std::vector<TVector> const& vecv) const {
+            std::vector<TVector> vecvResult(vecv.size(), TVector{});
+            for(std::size_t i = 0; i < m_vecvecpairblock.size(); ++i) {
+                boost::for_each(m_vecvecpairblock[i], [&](std::pair<std::size_t, TBlock> const& pairblock) {
+                    auto const v = Multiply(pairblock.second, vecv[pairblock.first]);
+                    for(int k = 0; k < 3; ++k) vecvResult[i][k] += v[k];
+                });
+            }
+            return vecvResult;
+        }
+
+        std::vector<std::vector<std::pair<std::size_t, TBlock>>> m_vecvecpairblock;
+    };
+
+    // Solves matH * x = vecvB by conjugate gradients, preconditioned with the inverted diagonal blocks.
+    // matH must be symmetric and positive definite.
+    std::vector<TVector> Solve(CSparseBlockMatrix const& matH, std::vector<TVector> const& vecvB) {
+        std::vector<TBlock> vecblockPreconditioner;
+        for(std::size_t i = 0; i < vecvB.size(); ++i) vecblockPreconditioner.emplace_back(Inverse(matH.diagonal(i)));
+        auto Precondition = [&](std::vector<TVector> const& vecv) {
+            std::vector<TVector> vecvResult;
+            for(std::size_t i = 0; i < vecv.size(); ++i) vecvResult.emplace_back(Multiply(vecblockPreconditioner[i], vecv[i]));
+            return vecvResult;
+        };
+
+        std::vector<TVector> vecvX(vecvB.size(), TVector{});
+        auto vecvResidual = vecvB;
+        auto vecvZ = Precondition(vecvResidual);
+        auto vecvDirection = vecvZ;
+        double fResidualZ = Dot(vecvResidual, vecvZ);
+        double const fResidualZInitial = fResidualZ;
+        for(std::size_t nIteration = 0; nIteration < 3 * vecvB.size() && 1e-12 * fResidualZInitial < fResidualZ; ++nIteration) {
+            auto const vecvHDirection = matH * vecvDirection;
+            double const fAlpha = fResidualZ / Dot(vecvDirection, vecvHDirection);
+            for(std::size_t i = 0; i < vecvX.size(); ++i) {
+                for(int k = 0; k < 3; ++k) {
+                    vecvX[i][k] += fAlpha * vecvDirection[i][k];
+                    vecvResidual[i][k] -= fAlpha * vecvHDirection[i][k];
+                }
+            }
+            vecvZ = Precondition(vecvResidual);
+            double const fResidualZNext = Dot(vecvResidual, vecvZ);
+            for(std::size_t i = 0; i < vecvDirection.size(); ++i) {
+                for(int k = 0; k < 3; ++k) vecvDirection[i][k] = vecvZ[i][k] + fResidualZNext / fResidualZ * vecvDirection[i][k];
+            }
+            fResidualZ = fResidualZNext;
+        }
+        return vecvX;
+    }
+
+    // Error of edge, i.e., the difference between the measured and the current relative pose
+    // in the frame of the measurement, and its Jacobians by poseFrom (blockA) and poseTo (blockB)
+    TVector Linearize(SPoseGraphEdge const& edge, rbt::pose<double> const& poseFrom, rbt::pose<double> const& poseTo, TBlock& blockA, TBlock& blockB) {
+        auto const szfLocal = (poseTo.m_pt - poseFrom.m_pt).rotated(-poseFrom.m_fYaw);
+        auto const szfError = (szfLocal - rbt::size<double>(edge.m_poseRelative.m_pt)).rotated(-edge.m_poseRelative.m_fYaw);
+        // Derivative of szfLocal by poseFrom.m_fYaw in the frame of the measurement
+        auto const szfDerivative = rbt::size<double>(szfLocal.y, -szfLocal.x).rotated(-edge.m_poseRelative.m_fYaw);
+
+        double const fCos = std::cos(poseFrom.m_fYaw + edge.m_poseRelative.m_fYaw);
+        double const fSin = std::sin(poseFrom.m_fYaw + edge.m_poseRelative.m_fYaw);
+        blockA = {{
+            -fCos, -fSin, szfDerivative.x,
+            fSin, -fCos, szfDerivative.y,
+            0, 0, -1
+        }};
+        blockB = {{
+            fCos, fSin, 0,
+            -fSin, fCos, 0,
+            0, 0, 1
+        }};
+        return {{szfError.x, szfError.y, std::remainder(poseTo.m_fYaw - poseFrom.m_fYaw - edge.m_poseRelative.m_fYaw, 2*M_PI)}};
+    }
+}
+
+std::size_t CPoseGraph::addNode(rbt::pose<double> const& pose) {
+    m_vecpose.emplace_back(pose);
+    return m_vecpose.size() - 1;
+}
+
+void CPoseGraph::addEdge(SPoseGraphEdge const& edge) {
+    ASSERT(edge.m_iFrom<m_vecpose.size() && edge.m_iTo<m_vecpose.size() && edge.m_iFrom!=edge.m_iTo);
+    m_vecedge.emplace_back(edge);
+}
+
+double CPoseGraph::optimize(int cIterations) {
+    double fChi2 = 0;
+    // The last linearization only computes the error of the optimized poses
+    for(int nIteration = 0; nIteration <= cIterations; ++nIteration) {
+        CSparseBlockMatrix matH(m_vecpose.size());
+        std::vector<TVector> vecvB(m_vecpose.size(), TVector{}); // -J^T * Omega * error
+        fChi2 = 0;
+        boost::for_each(m_vecedge, [&](SPoseGraphEdge const& edge) {
+            TBlock blockA;
+            TBlock blockB;
+            auto const vError = Linearize(edge, m_vecpose[edge.m_iFrom], m_vecpose[edge.m_iTo], blockA, blockB);
+            for(int k = 0; k < 3; ++k) fChi2 += rbt::sqr(vError[k]) * edge.m_afInformation[k];
+
+            // The first node is fixed, its rows and columns are left out
+            auto AddNode = [&](std::size_t i, TBlock const& block) {
+                if(0==i) return;
+                Add(matH.at(i, i), WeightedProduct(block, edge.m_afInformation, block));
+                auto const v = WeightedProduct(block, edge.m_afInformation, vError);
+                for(int k = 0; k < 3; ++k) vecvB[i][k] -= v[k];
+            };
+            AddNode(edge.m_iFrom, blockA);
+            AddNode(edge.m_iTo, blockB);
+            if(0!=edge.m_iFrom && 0!=edge.m_iTo) {
+                Add(matH.at(edge.m_iFrom, edge.m_iTo), WeightedProduct(blockA, edge.m_afInformation, blockB));
+                Add(matH.at(edge.m_iTo, edge.m_iFrom), WeightedProduct(blockB, edge.m_afInformation, blockA));
+            }
+        });
+        if(nIteration==cIterations) break;
+
+        matH.at(0, 0) = TBlock{{1, 0, 0, 0, 1, 0, 0, 0, 1}};
+        auto const vecvDelta = Solve(matH, vecvB);
+        for(std::size_t i = 0; i < m_vecpose.size(); ++i) {
+            m_vecpose[i].m_pt += rbt::size<double>(vecvDelta[i][0], vecvDelta[i][1]);
+            m_vecpose[i].m_fYaw += vecvDelta[i][2];
+        }
+    }
+    return fChi2;
+}
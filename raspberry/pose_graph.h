@@ -0,0 +1,43 @@
+#pragma once
+
+#include "geometry.h"
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// Pose of poseRelative, given in the frame of pose, in world coordinates.
+// Same composition as the odometry in SOdometryAccumulator.
+rbt::pose<double> ComposePose(rbt::pose<double> const& pose, rbt::pose<double> const& poseRelative);
+// Inverse of ComposePose, i.e., poseTo in the frame of poseFrom
+rbt::pose<double> RelativePose(rbt::pose<double> const& poseFrom, rbt::pose<double> const& poseTo);
+
+struct SPoseGraphEdge {
+    std::size_t m_iFrom;
+    std::size_t m_iTo;
+    rbt::pose<double> m_poseRelative; // measured pose of node m_iTo in the frame of node m_iFrom
+    std::array<double, 3> m_afInformation; // diagonal information matrix of x, y (1/cm^2) and yaw (1/rad^2)
+};
+
+// Graph of 2D robot poses connected by relative pose measurements,
+// see Grisetti et al "A Tutorial on Graph-Based SLAM" (2010).
+//
+// optimize() runs Gauss-Newton iterations starting from the current poses. The normal
+// equations are stored as a sparse matrix of 3x3 blocks, one per node and one per pair
+// of connected nodes, and solved by conjugate gradients preconditioned with the inverted
+// diagonal blocks. Memory and the cost of an iteration grow linearly with the number of
+// nodes and edges. The first node is fixed.
+struct CPoseGraph {
+    std::size_t addNode(rbt::pose<double> const& pose);
+    void addEdge(SPoseGraphEdge const& edge);
+
+    // Returns the sum of the squared, information weighted errors of all edges after optimizing
+    double optimize(int cIterations);
+
+    std::vector<rbt::pose<double>> const& Poses() const { return m_vecpose; }
+    std::vector<SPoseGraphEdge> const& Edges() const { return m_vecedge; }
+
+private:
+    std::vector<rbt::pose<double>> m_vecpose;
+    std::vector<SPoseGraphEdge> m_vecedge;
+};
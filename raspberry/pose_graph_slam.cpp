@@ -0,0 +1,186 @@
+#include "pose_graph_slam.h"
+#include "robot_configuration.h"
+#include "error_handling.h"
+#include "occupancy_grid.inl"
+#include "map_snapshot.h"
+#include "correlative_scan_matcher.h"
+
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+namespace {
+    std::array<double, 3> Information(double fSigma, double fSigmaAngle) {
+        return {{1 / rbt::sqr(fSigma), 1 / rbt::sqr(fSigma), 1 / rbt::sqr(rbt::rad(fSigmaAngle))}};
+    }
+}
+
+CPoseGraphSlam::CPoseGraphSlam()
+    : m_bMapOutdated(false)
+    , m_matnMap(m_occgrid.ObstacleMap())
+    , m_ikeyframeLoopClosure(0)
+    , m_bRelocalize(false)
+    , m_cposeLoaded(0)
+{}
+
+bool CPoseGraphSlam::receivedSensorData(SScanLine const& scanlineSensor) {
+    // The first scan line initializes the map
+    SScanLine scanline;
+    if(!m_odomacc.add(scanlineSensor, /*bForce*/ m_vecscanline.empty() || m_bRelocalize, scanline)) return false;
+
+    // Scan matching needs the map at the optimized poses
+    updateMap();
+
+    auto posePrevious = m_vecpose.empty() ? rbt::pose<double>::zero() : m_vecpose.back();
+    if(m_bRelocalize) {
+        m_bRelocalize = false;
+        auto const vechyp = GlobalRelocalization(scanline.downsampled(), m_occgridLoaded, 1);
+        if(vechyp.empty()) {
+            LOG("Relocalization failed, continuing from the saved pose");
+        } else {
+            LOG("Relocalized at " << vechyp.front().m_pose << " score = " << vechyp.front().m_fScore);
+            posePrevious = vechyp.front().m_pose;
+            scanline.m_pose = rbt::pose<double>::zero(); // odometry is relative to the unknown previous pose
+        }
+    }
+
+    // Match a downsampled scan line, update the map with all scans
+    auto const pose = m_occgrid.fit(ComposePose(posePrevious, scanline.m_pose), scanline.downsampled(), escanmatcherICP_LOOKUP);
+    auto const ikeyframe = m_posegraph.addNode(pose);
+    if(0<ikeyframe) {
+        m_posegraph.addEdge(SPoseGraphEdge{
+            ikeyframe - 1, ikeyframe,
+            RelativePose(m_posegraph.Poses()[ikeyframe - 1], pose),
+            Information(c_fKeyframeSigma, c_fKeyframeSigmaAngle)
+        });
+    }
+    m_vecscanline.emplace_back(scanline);
+    m_vecpose.emplace_back(pose);
+    m_vecposeMap.emplace_back(pose);
+
+    m_occgrid.ClearDirtyRect();
+    m_occgrid.update(pose, scanline);
+    m_occgrid.UpdateDistanceField();
+    m_occgrid.UpdateObstacleMap(m_matnMap, c_rectnMapWindow);
+
+    if(m_ikeyframeLoopClosure + c_nLoopClosureInterval <= ikeyframe) closeLoop();
+    return true;
+}
+
+void CPoseGraphSlam::closeLoop() {
+    auto const& vecpose = m_posegraph.Poses();
+    auto const ikeyframe = vecpose.size() - 1;
+    m_ikeyframeLoopClosure = ikeyframe;
+    if(ikeyframe < c_nLoopClosureMinAge) return;
+
+    // Closest keyframe that is old enough
+    auto const ikeyframeLast = ikeyframe - c_nLoopClosureMinAge;
+    std::size_t ikeyframeCandidate = 0;
+    double fSqrDistanceMin = std::numeric_limits<double>::max();
+    for(std::size_t i = 0; i <= ikeyframeLast; ++i) {
+        auto const fSqrDistance = (vecpose[i].m_pt - vecpose[ikeyframe].m_pt).SqrAbs();
+        if(fSqrDistance < fSqrDistanceMin) {
+            fSqrDistanceMin = fSqrDistance;
+            ikeyframeCandidate = i;
+        }
+    }
+    if(rbt::sqr(c_fLoopClosureDistance) < fSqrDistanceMin) return;
+
+    // Submap of the candidate's neighbors at their current poses
+    COccupancyGridWithObstacleList occgridSubmap;
+    auto const ikeyframeBegin = ikeyframeCandidate - std::min<std::size_t>(ikeyframeCandidate, c_nLoopClosureSubmap);
+    auto const ikeyframeEnd = std::min<std::size_t>(ikeyframeCandidate + c_nLoopClosureSubmap, ikeyframeLast) + 1;
+    for(auto i = ikeyframeBegin; i < ikeyframeEnd; ++i) {
+        occgridSubmap.update(vecpose[i], m_vecscanline[i]);
+    }
+    occgridSubmap.UpdateCorrelativeTables(c_nLoopClosureLevels);
+
+    auto const scanlineMatch = m_vecscanline[ikeyframe].downsampled();
+    auto const hyp = CorrelativeScanMatch(
+        vecpose[ikeyframe], scanlineMatch, occgridSubmap.CorrelativeTables(),
+        c_nLoopClosureSearchRadius, c_fLoopClosureSearchAngle, c_nLoopClosureLevels
+    );
+    LOG("Loop closure " << ikeyframe << " -> " << ikeyframeCandidate << ": " << vecpose[ikeyframe] << " -> " << hyp.m_pose << " score = " << hyp.m_fScore);
+    if(hyp.m_fScore < c_fLoopClosureMinScore) return;
+
+    // Refine below the resolution of the lookup tables
+    auto const pose = occgridSubmap.fit(hyp.m_pose, scanlineMatch, escanmatcherICP_LOOKUP);
+    m_posegraph.addEdge(SPoseGraphEdge{
+        ikeyframeCandidate, ikeyframe,
+        RelativePose(vecpose[ikeyframeCandidate], pose),
+        Information(c_fLoopClosureSigma, c_fLoopClosureSigmaAngle)
+    });
+    auto const fChi2 = m_posegraph.optimize(c_nPoseGraphIterations);
+    LOG("============ Optimized pose graph, chi2 = " << fChi2 << " ============");
+
+    std::copy(vecpose.begin(), vecpose.end(), m_vecpose.begin() + m_cposeLoaded);
+
+    // Rebuilding the map costs a map update per keyframe, skip it if the map barely changes
+    for(std::size_t i = 0; i < vecpose.size() && !m_bMapOutdated; ++i) {
+        m_bMapOutdated = rbt::sqr(c_fMapRebuildDistance) < (vecpose[i].m_pt - m_vecposeMap[i].m_pt).SqrAbs()
+            || rbt::rad(c_fMapRebuildAngle) < std::abs(std::remainder(vecpose[i].m_fYaw - m_vecposeMap[i].m_fYaw, 2*M_PI));
+    }
+}
+
+void CPoseGraphSlam::updateMap() {
+    if(!m_bMapOutdated) return;
+
+    // Copying the loaded map only shares its tiles
+    m_occgrid = m_occgridLoaded;
+    auto const& vecpose = m_posegraph.Poses();
+    for(std::size_t i = 0; i < vecpose.size(); ++i) {
+        m_occgrid.update(vecpose[i], m_vecscanline[i]);
+    }
+    m_occgrid.UpdateDistanceField();
+    m_matnMap = m_occgrid.ObstacleMap();
+    m_vecposeMap = vecpose;
+    m_bMapOutdated = false;
+}
+
+cv::Mat CPoseGraphSlam::getMapWithPoses() {
+    updateMap();
+    return ObstacleMapWithPoses(m_matnMap.clone(), m_vecpose);
+}
+
+cv::Mat CPoseGraphSlam::getMap() {
+    updateMap();
+    return m_matnMap.clone(); // callers draw into the map
+}
+
+std::vector<cv::Mat> CPoseGraphSlam::getMapPyramid() {
+    updateMap();
+    return m_occgrid.ObstacleMapPyramid(c_rectnMapWindow);
+}
+
+cv::Mat CPoseGraphSlam::getMapWithPose() {
+    updateMap();
+    cv::Mat matColor;
+    cvtColor(m_matnMap, matColor, CV_GRAY2RGB);
+    if(!m_vecpose.empty()) RenderRobotPose(matColor, m_vecpose.back(), cv::Scalar(255, 0, 0));
+    return matColor;
+}
+
+bool CPoseGraphSlam::SaveMap(std::string const& strFile) {
+    updateMap();
+    return SaveMapSnapshot(strFile, m_occgrid, m_vecpose);
+}
+
+bool CPoseGraphSlam::LoadMap(std::string const& strFile, bool bRelocalize) {
+    std::vector<rbt::pose<double>> vecpose;
+    if(!LoadMapSnapshot(strFile, m_occgridLoaded, vecpose)) return false;
+
+    m_occgrid = m_occgridLoaded;
+    m_bMapOutdated = false;
+    m_matnMap = m_occgrid.ObstacleMap();
+    m_posegraph = CPoseGraph();
+    m_vecscanline.clear();
+    m_vecposeMap.clear();
+    m_ikeyframeLoopClosure = 0;
+    m_odomacc = SOdometryAccumulator();
+    m_bRelocalize = bRelocalize;
+    m_cposeLoaded = vecpose.size();
+    m_vecpose = std::move(vecpose);
+    return true;
+}
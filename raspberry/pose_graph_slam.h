@@ -0,0 +1,71 @@
+#pragma once
+
+#include "geometry.h"
+#include "nonmoveable.h"
+#include "pose_graph.h"
+#include "scanline.h"
+#include "scanmatching.h"
+
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// Graph-based SLAM with a single map, see Grisetti et al "A Tutorial on Graph-Based SLAM" (2010)
+// and the loop closure search in Hess et al "Real-Time Loop Closure in 2D LIDAR SLAM" (ICRA 2016).
+//
+// Every processed scan line becomes a keyframe, i.e., a node of a CPoseGraph. Its pose is
+// found by matching the scan line against the map of all previous keyframes and it is connected
+// to the previous keyframe by the matched relative pose. Every c_nLoopClosureInterval keyframes,
+// the closest keyframe at least c_nLoopClosureMinAge keyframes older is searched for a loop
+// closure: The scan line is matched against a submap of the old keyframe's neighbors with a
+// wide CorrelativeScanMatch. A good match adds an edge to the old keyframe and the graph is
+// optimized, starting from the current poses.
+//
+// Only the keyframe poses and scan lines are stored, so memory grows linearly with the length
+// of the trajectory. After a loop closure moved any keyframe by more than c_fMapRebuildDistance
+// or c_fMapRebuildAngle, the map is rebuilt from the scan lines at the optimized poses when 
+// it is needed next. Smaller corrections keep the map.
+struct CPoseGraphSlam : rbt::nonmoveable {
+    CPoseGraphSlam();
+
+    // Processes scanline if the robot moved by c_fUpdateDistance or turned by c_fUpdateAngle
+    // since the last keyframe and returns true, see SOdometryAccumulator
+    bool receivedSensorData(SScanLine const& scanline);
+
+    // The map accessors rebuild the map first if the keyframe poses changed
+    cv::Mat getMapWithPoses();
+    cv::Mat getMapWithPose();
+    cv::Mat getMap();
+    std::vector<cv::Mat> getMapPyramid();
+
+    // Saved poses followed by the keyframe poses
+    std::vector<rbt::pose<double>> const& Poses() const { return m_vecpose; }
+
+    // Saves the map and the pose history, see map_snapshot.h
+    bool SaveMap(std::string const& strFile);
+    // Starts from a saved map at the last saved pose. The saved map is the base of every
+    // rebuilt map, the keyframes of the saved session are not part of the pose graph.
+    // If bRelocalize, the first keyframe starts at the pose found by GlobalRelocalization instead.
+    bool LoadMap(std::string const& strFile, bool bRelocalize = false);
+
+private:
+    // Searches a loop closure for the last keyframe and optimizes the graph if one is found
+    void closeLoop();
+    // Rebuilds m_occgrid from m_occgridLoaded and all keyframes if the keyframe poses changed
+    void updateMap();
+
+    COccupancyGridWithObstacleList m_occgridLoaded; // loaded with LoadMap, empty otherwise
+    COccupancyGridWithObstacleList m_occgrid; // m_occgridLoaded with all keyframes integrated
+    bool m_bMapOutdated; // keyframe poses changed since m_occgrid has been built
+    std::vector<rbt::pose<double>> m_vecposeMap; // keyframe poses integrated into m_occgrid
+    cv::Mat m_matnMap; // renders c_rectnMapWindow of m_occgrid
+
+    CPoseGraph m_posegraph;
+    std::vector<SScanLine> m_vecscanline; // scan line of every keyframe
+    std::size_t m_ikeyframeLoopClosure; // keyframe of the last loop closure search
+
+    SOdometryAccumulator m_odomacc;
+    bool m_bRelocalize; // relocalize with the next scan line
+    std::size_t m_cposeLoaded;
+    std::vector<rbt::pose<double>> m_vecpose; // m_cposeLoaded saved poses followed by the keyframe poses
+};
@@ -0,0 +1,49 @@
+#include "random_generator.h"
+
+#include <random>
+
+namespace {
+    std::uint64_t splitmix64(std::uint64_t& n) {
+        std::uint64_t z = (n += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    std::uint64_t& RunSeed() {
+        static std::uint64_t s_nSeed = [] {
+            std::random_device rd;
+            return (static_cast<std::uint64_t>(rd()) << 32) ^ rd();
+        }();
+        return s_nSeed;
+    }
+}
+
+CRandomGenerator::CRandomGenerator(std::uint64_t nSeed) {
+    seed(nSeed);
+}
+
+void CRandomGenerator::seed(std::uint64_t nSeed) {
+    for(auto& n : m_an) n = splitmix64(nSeed);
+}
+
+void SetRandomSeed(std::uint64_t nSeed) {
+    RunSeed() = nSeed;
+}
+
+std::uint64_t RandomSeed() {
+    return RunSeed();
+}
+
+CRandomGenerator& RandomGenerator() {
+    thread_local CRandomGenerator t_rng(RandomSeed());
+    return t_rng;
+}
+
+void SeedRandomGenerator(std::uint64_t nScan, std::uint64_t nTask) {
+    // Mix the keys one after another, so (nScan, nTask) and (nTask, nScan) differ
+    std::uint64_t n = RandomSeed();
+    n = splitmix64(n) ^ nScan;
+    n = splitmix64(n) ^ nTask;
+    RandomGenerator().seed(n);
+}
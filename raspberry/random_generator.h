@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+// xoshiro256** by Blackman and Vigna, see http://prng.di.unimi.it
+// Satisfies UniformRandomBitGenerator, so it can be used with the <random> distributions.
+// Much cheaper than std::random_device, which may read from the kernel on every call.
+struct CRandomGenerator {
+    using result_type = std::uint64_t;
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    // The state is initialized from nSeed with splitmix64 as recommended by the authors
+    explicit CRandomGenerator(std::uint64_t nSeed = 0);
+    void seed(std::uint64_t nSeed);
+
+    result_type operator()() {
+        auto const nResult = rotl(m_an[1] * 5, 7) * 9;
+        auto const n = m_an[1] << 17;
+        m_an[2] ^= m_an[0];
+        m_an[3] ^= m_an[1];
+        m_an[1] ^= m_an[2];
+        m_an[0] ^= m_an[3];
+        m_an[2] ^= n;
+        m_an[3] = rotl(m_an[3], 45);
+        return nResult;
+    }
+
+private:
+    static std::uint64_t rotl(std::uint64_t n, int k) {
+        return (n << k) | (n >> (64 - k));
+    }
+    std::uint64_t m_an[4];
+};
+
+// The run seed all generators are derived from. Chosen from std::random_device 
+// unless set by SetRandomSeed, which must be called before any thread draws random numbers.
+void SetRandomSeed(std::uint64_t nSeed);
+std::uint64_t RandomSeed();
+
+// Generator of the calling thread
+CRandomGenerator& RandomGenerator();
+
+// Reseeds the generator of the calling thread from the run seed, nScan and nTask. 
+// Tasks running on a thread pool reseed with e.g. the scan line and particle index 
+// first, so they draw the same numbers regardless of the thread they run on and 
+// replays with the same run seed are identical.
+void SeedRandomGenerator(std::uint64_t nScan, std::uint64_t nTask);
@@ -1,8 +1,10 @@
 #include "rover.h"
 #include "geometry.h"
 #include "particle_slam.h"
+#include "distance_field.h"
 #include "error_handling.h"
 #include "robot_configuration.h"
+#include "random_generator.h"
 
 #include <random>
 #include <opencv2/imgproc.hpp>
@@ -79,7 +81,6 @@ rbt::point<double> Obstacle(rbt::pose<double> const& pose, double fRadAngle, dou
     return rbt::point<double>(pose.m_pt + szfLidar.rotated(pose.m_fYaw));
 }
 
-static std::random_device s_rd;
 rbt::pose<double> sample_motion_model(rbt::pose<double> const& pose, rbt::size<double> const& szf, double fRadAngle) {
     // http://gki.informatik.uni-freiburg.de/lehre/ws0203/Robotik/papers/kalman/kurt_robot_notes.pdf
     // TODO: Make measurements to get actual errors
@@ -92,7 +93,7 @@ rbt::pose<double> sample_motion_model(rbt::pose<double> const& pose, rbt::size<d
         if(0!=fDistance) { 
             // there was actual movement -> sample range error
             auto const szfSampled = szf.normalized() 
-                * std::normal_distribution<double>(fDistance, c_fRangeStdDev * fDistance)(s_rd);
+                * std::normal_distribution<double>(fDistance, c_fRangeStdDev * fDistance)(RandomGenerator());
             return szfSampled.rotated(pose.m_fYaw);
         } else {
             return rbt::size<double>::zero();
@@ -106,14 +107,11 @@ rbt::pose<double> sample_motion_model(rbt::pose<double> const& pose, rbt::size<d
             std::normal_distribution<double>(
                 fRadAngle, 
                 std::sqrt(c_fTurnVar * std::abs(fRadAngle) + c_fDriftVar * fDistance)
-            )(s_rd)
+            )(RandomGenerator())
         );
 }
 
-double measurement_model_map(rbt::pose<double> const& pose, 
-    SScanLine const& scanline, 
-    std::function<double (rbt::point<double>)> Distance
-) {
+double measurement_model_point(double fDistance) {
     // Likelihood field model
     // Thrun, Probabilistic Robotics, p. 169ff
 
@@ -124,12 +122,36 @@ double measurement_model_map(rbt::pose<double> const& pose,
 
     double const c_fSensorSigma = 2; // ~ +-10cm with current map scale, in grid coordinates
 
+    return z_hit * gauss_probability(fDistance, c_fSensorSigma) + z_rand;
+}
+
+double measurement_model_map(rbt::pose<double> const& pose, 
+    SScanLine const& scanline, 
+    std::function<double (rbt::point<double>)> Distance
+) {
     double fWeight = 1.0;
     boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
-        double const fLikelihood = 
-            z_hit * gauss_probability( Distance(Obstacle(pose, scan.m_fRadAngle, scan.m_nDistance)), c_fSensorSigma) 
-            + z_rand; 
-        fWeight = fWeight * fLikelihood;
+        fWeight = fWeight * measurement_model_point(Distance(Obstacle(pose, scan.m_fRadAngle, scan.m_nDistance)));
     });
     return fWeight;
 }
+
+double measurement_model_map(rbt::pose<double> const& pose, SScanLine const& scanline, CDistanceField const& distfield) {
+    return measurement_model_map(pose, scanline, [&](rbt::point<double> const& ptf) {
+        return static_cast<double>(distfield.distance(ToGridCoordinate(ptf)));
+    });
+}
+
+double log_likelihood_field(rbt::pose<double> const& pose, SScanLine const& scanline, CDistanceField const& distfield) {
+    double const c_fSensorSigma = 10; // ~ +-10cm
+    // The kernel search in log_likelihood_field(..., TOccupancyGrid) penalizes 
+    // unmatched obstacles with a squared distance of 60, clamp to the same value 
+    double const c_fMaxSqrDist = 60;
+
+    double fLogLikelihood = 0.0;
+    boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
+        double const fDistance = distfield.distance(ToGridCoordinate(Obstacle(pose, scan.m_fRadAngle, scan.m_nDistance))) * c_nScale;
+        fLogLikelihood += (-1./c_fSensorSigma) * std::min(rbt::sqr(fDistance), c_fMaxSqrDist);
+    });
+    return fLogLikelihood;
+}
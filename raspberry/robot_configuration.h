@@ -21,9 +21,16 @@ rbt::pose<double> UpdatePose(rbt::pose<double> const& pose, int nTicksLeft, int
 // Occupancy grid
 int constexpr c_nScale = 5; // 5cm / px
 int constexpr c_nMapExtent = 400; // px ~ 20m
+// The occupancy grids are unbounded, but map images are rendered for a fixed window 
+// of c_nMapExtent x c_nMapExtent px around the origin. 
+rbt::rect<int> constexpr c_rectnMapWindow{0, 0, c_nMapExtent-1, c_nMapExtent-1};
 double constexpr c_fOccupiedDelta = 2;
 double constexpr c_fFreeDelta = -0.5;
 double constexpr c_fFreeThreshold = 1;
+int constexpr c_nMaxObstacleDistance = 10; // px, distances in CDistanceField are clamped to this
+// Scan matching and particle scoring use a downsampled scan line, see SScanLine::downsampled.
+// Consecutive scan points closer than this are dropped, ~ 2 cells.
+int constexpr c_nScanMinPointDistance = 10; // cm
 
 rbt::point<int> ToGridCoordinate(rbt::point<double> const& pt);
 rbt::pose<int> ToGridCoordinate(rbt::pose<double> const& pose);
@@ -46,8 +53,62 @@ const int c_nRobotHeight = 30; // cm
 const float c_fOccupancyRover = -100; // value in occupancy grid of positions occupied by rover itself
 
 // Particle filter
+struct CDistanceField;
+
 rbt::pose<double> sample_motion_model(rbt::pose<double> const& pose, rbt::size<double> const& szf, double fRadAngle);
+// Likelihood of a scan point at distance fDistance (in grid cells) to the closest obstacle
+double measurement_model_point(double fDistance);
 double measurement_model_map(rbt::pose<double> const& pose, SScanLine const& scanline, std::function<double (rbt::point<double>)> Distance);
+double measurement_model_map(rbt::pose<double> const& pose, SScanLine const& scanline, CDistanceField const& distfield);
+
+// Same scoring as log_likelihood_field below but looks up the distance to the closest
+// obstacle in the distance field. One lookup per scan point instead of a 3x3 kernel search.
+double log_likelihood_field(rbt::pose<double> const& pose, SScanLine const& scanline, CDistanceField const& distfield);
+
+// Correlative scan matcher, see correlative_scan_matcher.h
+int constexpr c_nCorrelativeSearchRadius = 6; // px, translations in +-30cm are searched
+double constexpr c_fCorrelativeSearchAngle = 10; // degrees, rotations in +-10 degrees are searched
+int constexpr c_nCorrelativeLevels = 4; // lookup tables for regions of 1, 2, 4 and 8 px
+double constexpr c_fCorrelativeSigma = 2; // px, std deviation of the scan point likelihood
+
+// Global relocalization, see GlobalRelocalization in correlative_scan_matcher.h
+int constexpr c_nRelocalizationLevels = 7; // the coarsest lookup table covers regions of 64 px
+double constexpr c_fRelocalizationMinScore = 0.5; // fraction of the score if all scan points were on obstacles
+int constexpr c_nRelocalizationSeparation = 10; // px, minimum distance between two hypotheses
+double constexpr c_fRelocalizationSeparationAngle = 10; // degrees
+
+// CFastParticleSlamBase only processes scan lines after the robot moved or turned this much,
+// see linearUpdate and angularUpdate in gmapping
+double constexpr c_fUpdateDistance = 10; // cm
+double constexpr c_fUpdateAngle = 5; // degrees
+
+// KLD-sampling in CFastParticleSlamBase, see Fox "Adapting the Sample Size in Particle Filters Through KLD-Sampling"
+int constexpr c_nKLDBinSize = 20; // cm, particle poses are counted in histogram bins of 20cm x 20cm x 10 degrees
+double constexpr c_fKLDBinAngle = 10; // degrees
+// Fox's epsilon = 0.05 and 99% quantile already ask for 66 particles if the poses occupy 2 bins.
+// These looser values ask for 6 particles at 2 bins and 50 particles at ~18 bins, so the count
+// adapts within the 5 to 50 particles CRobotStrategy can afford.
+double constexpr c_fKLDEpsilon = 0.25; // maximum K-L distance between sampled and true posterior
+double constexpr c_fKLDQuantile = 1.282; // upper 0.1 quantile of the standard normal distribution, bound holds with 90% probability
+
+// Pose graph SLAM, see pose_graph_slam.h
+double constexpr c_fKeyframeSigma = 5; // cm, std deviation of the scan matched pose relative to the previous keyframe
+double constexpr c_fKeyframeSigmaAngle = 2; // degrees
+double constexpr c_fLoopClosureSigma = 10; // cm, std deviation of a loop closure
+double constexpr c_fLoopClosureSigmaAngle = 4; // degrees
+int constexpr c_nLoopClosureMinAge = 50; // keyframes, younger keyframes are not searched for loop closures
+int constexpr c_nLoopClosureInterval = 10; // keyframes between two loop closure searches
+double constexpr c_fLoopClosureDistance = 150; // cm, maximum distance to a loop closure candidate
+int constexpr c_nLoopClosureSubmap = 10; // keyframes, the candidate's submap contains +-10 keyframes around it
+int constexpr c_nLoopClosureSearchRadius = 20; // px, translations in +-1m are searched
+double constexpr c_fLoopClosureSearchAngle = 20; // degrees
+int constexpr c_nLoopClosureLevels = 6; // the coarsest lookup table covers regions of 32 px
+double constexpr c_fLoopClosureMinScore = 0.6; // fraction of the score if all scan points were on obstacles
+int constexpr c_nPoseGraphIterations = 5; // Gauss-Newton iterations after adding a loop closure
+// The map is only rebuilt after a loop closure if a keyframe moved by about a map cell,
+// i.e., by c_nScale or by a rotation that moves a scan point 1.5m away by c_nScale
+double constexpr c_fMapRebuildDistance = c_nScale; // cm
+double constexpr c_fMapRebuildAngle = 2; // degrees
 
 const double c_fSqrt2 = std::sqrt(2);
 
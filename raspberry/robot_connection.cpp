@@ -267,10 +267,14 @@ private:
 	bool const m_bManual;
 };
 
-int ConnectToRobot(std::string const& strPort, std::string const& strLidar, std::ofstream& ofsLog, bool bManual, boost::optional<std::string> const& strOutput) {
+template<typename TRobotStrategy>
+int ConnectToRobotT(std::string const& strPort, std::string const& strLidar, std::ofstream& ofsLog, bool bManual, boost::optional<std::string> const& strOutput, 
+	boost::optional<std::string> const& ostrLoadMap, boost::optional<std::string> const& ostrSaveMap, bool bRelocalize
+) {
 	// Establish robot connection via serial port
 	try {
-		CRobotStrategy robotstrategy;
+		TRobotStrategy robotstrategy;
+		if(ostrLoadMap && !robotstrategy.LoadMap(ostrLoadMap.get(), bRelocalize)) return 1;
 		robotstrategy.PrintHelp();
 
 		// State shared between main thread communicating with robot, 
@@ -424,8 +428,8 @@ int ConnectToRobot(std::string const& strPort, std::string const& strLidar, std:
 			std::cout << "See raspberry/html/map.html for an example on how to control the robot via http" << std::endl;
 		}
 
-		std::thread t([&robotstrategy, &rc, &bManual, &m, &cv, &scanlineNext, &strOutput] {
-			bool bLastUpdateZeroMovement = false;
+		std::thread t([&robotstrategy, &rc, &bManual, &m, &cv, &scanlineNext, &strOutput, &ostrSaveMap] {
+			int cScansSinceSnapshot = 0;
 			while(true) {	
 				SScanLine scanline;
 				{
@@ -435,13 +439,10 @@ int ConnectToRobot(std::string const& strPort, std::string const& strLidar, std:
 					scanlineNext.clear();
 				}
 				
-				auto const bZeroMovement = scanline.translation()==rbt::size<double>::zero() && scanline.rotation()==0.0;
-				if(!bLastUpdateZeroMovement || !bZeroMovement) { // ignore successive scans with zero movement
-					bLastUpdateZeroMovement = bZeroMovement;
-
-					auto const rcmd = robotstrategy.receivedSensorData(scanline);
+				// Scan lines with little movement only update the odometry
+				if(auto const orcmd = robotstrategy.receivedSensorData(scanline)) {
 					if(!bManual) {
-						rc.send_command(rcmd);
+						rc.send_command(orcmd.get());
 					}
 
 					if(strOutput) {
@@ -454,6 +455,14 @@ int ConnectToRobot(std::string const& strPort, std::string const& strLidar, std:
 							std::abort();
 						}
 					}	
+
+					// The robot is usually stopped by killing the process,
+					// save the map periodically instead of on exit
+					int constexpr c_nScansPerSnapshot = 50;
+					if(ostrSaveMap && c_nScansPerSnapshot<=++cScansSinceSnapshot) {
+						robotstrategy.SaveMap(ostrSaveMap.get());
+						cScansSinceSnapshot = 0;
+					}
 				}
 			}
 		});
@@ -469,3 +478,13 @@ int ConnectToRobot(std::string const& strPort, std::string const& strLidar, std:
 		return 1;
 	}
 }
+
+int ConnectToRobot(std::string const& strPort, std::string const& strLidar, std::ofstream& ofsLog, bool bManual, boost::optional<std::string> const& strOutput, 
+	boost::optional<std::string> const& ostrLoadMap, boost::optional<std::string> const& ostrSaveMap, bool bLocalize, bool bPoseGraph, bool bRelocalize
+) {
+	return bLocalize
+		? ConnectToRobotT<CLocalizationStrategy>(strPort, strLidar, ofsLog, bManual, strOutput, ostrLoadMap, ostrSaveMap, bRelocalize)
+		: bPoseGraph
+		? ConnectToRobotT<CPoseGraphStrategy>(strPort, strLidar, ofsLog, bManual, strOutput, ostrLoadMap, ostrSaveMap, bRelocalize)
+		: ConnectToRobotT<CRobotStrategy>(strPort, strLidar, ofsLog, bManual, strOutput, ostrLoadMap, ostrSaveMap, bRelocalize);
+}
@@ -1,10 +1,40 @@
 #pragma once
 
 #include "fast_particle_slam.h"
+#include "monte_carlo_localization.h"
+#include "pose_graph_slam.h"
 #include "scanline.h"
 
-struct CRobotStrategy : CFastParticleSlamBase {
-    SRobotCommand receivedSensorData(SScanLine const& scanline);    
-    void PrintHelp();
-    void OnChar(char ch);
-};
\ No newline at end of file
+#include <utility>
+#include <boost/optional.hpp>
+
+// Computes the robot commands from the poses estimated by TLocalization, 
+// i.e., CFastParticleSlamBase, CMonteCarloLocalization or CPoseGraphSlam
+template<typename TLocalization>
+struct CRobotStrategyT : TLocalization {
+    template<typename... Args>
+    explicit CRobotStrategyT(Args&&... args) : TLocalization(std::forward<Args>(args)...) {}
+
+    // boost::none if the scan line has not been processed, see TLocalization::receivedSensorData
+    boost::optional<SRobotCommand> receivedSensorData(SScanLine const& scanline) {
+        if(!TLocalization::receivedSensorData(scanline)) return boost::none;
+        // TODO: Calculate strategy, return robot control
+        return SRobotCommand::stop();
+    }
+    void PrintHelp() {}
+    void OnChar(char ch) {}
+};
+
+// Maps the environment while driving
+struct CRobotStrategy : CRobotStrategyT<CFastParticleSlamBase> {
+    // The robot command only depends on the new pose, so don't wait for the map update
+    CRobotStrategy() : CRobotStrategyT(5, 50, escanmatcherICP_LOOKUP, /*bPipelined*/ true) {}
+};
+
+// Maps the environment with a single map and closes loops by pose graph optimization
+struct CPoseGraphStrategy : CRobotStrategyT<CPoseGraphSlam> {};
+
+// Localizes on a map loaded with LoadMap
+struct CLocalizationStrategy : CRobotStrategyT<CMonteCarloLocalization> {
+    CLocalizationStrategy() : CRobotStrategyT(200) {}
+};
@@ -37,7 +37,41 @@ double SScanLine::rotation() const {
     return m_pose.m_fYaw;
 }
 
+SScanLine SScanLine::downsampled() const {
+    SScanLine scanline;
+    scanline.m_pose = m_pose;
+
+    auto szfLast = rbt::size<double>::zero();
+    boost::for_each(m_vecscan, [&](SScan const& scan) {
+        auto const szf = rbt::size<double>::fromAngleAndDistance(scan.m_fRadAngle, scan.m_nDistance);
+        if(scanline.m_vecscan.empty() || rbt::sqr(c_nScanMinPointDistance) <= (szf - szfLast).SqrAbs()) {
+            scanline.m_vecscan.emplace_back(scan);
+            szfLast = szf;
+        }
+    });
+    return scanline;
+}
+
 void SScanLine::clear() {
     m_pose = rbt::pose<double>::zero();
     m_vecscan.clear();
 }
+
+/////////////////////
+// SOdometryAccumulator
+bool SOdometryAccumulator::add(SScanLine const& scanline, bool bForce, SScanLine& scanlineUpdate) {
+    m_pose = rbt::pose<double>(
+        m_pose.m_pt + scanline.translation().rotated(m_pose.m_fYaw),
+        m_pose.m_fYaw + scanline.rotation()
+    );
+    if(!bForce
+    && rbt::size<double>(m_pose.m_pt).SqrAbs() < rbt::sqr(c_fUpdateDistance) 
+    && std::abs(m_pose.m_fYaw) < rbt::rad(c_fUpdateAngle)) {
+        return false;
+    }
+
+    scanlineUpdate.m_pose = m_pose;
+    scanlineUpdate.m_vecscan = scanline.m_vecscan;
+    m_pose = rbt::pose<double>::zero();
+    return true;
+}
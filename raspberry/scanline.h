@@ -25,6 +25,13 @@ struct SScanLine {
 
     rbt::size<double> translation() const;
     double rotation() const;
+
+    // Copy with the same odometry, but only with scans whose obstacle is at least
+    // c_nScanMinPointDistance away from the obstacle of the previously kept scan.
+    // Nearby obstacles are sampled densely by the Lidar, so this mostly thins out
+    // close walls and keeps the sparse distant points.
+    // Used for scan matching and scoring, the map is updated with the full scan line.
+    SScanLine downsampled() const;
     
     // returns false iff scan line is complete, i.e., contains 360 degree measurements
     // and data belongs into new SScanLine
@@ -33,6 +40,18 @@ struct SScanLine {
     void clear();
 };
 
+// Accumulates the odometry of scan lines while the robot hardly moves, so that the 
+// particle filters can skip them, see linearUpdate and angularUpdate in gmapping
+struct SOdometryAccumulator {
+    rbt::pose<double> m_pose = rbt::pose<double>::zero(); // odometry since the last returned scan line
+
+    // Adds the odometry of scanline, which is relative to the pose at the previous scan line.
+    // Returns true if the robot moved by c_fUpdateDistance or turned by c_fUpdateAngle
+    // in total or if bForce. scanlineUpdate then holds the scans of scanline and the 
+    // accumulated odometry.
+    bool add(SScanLine const& scanline, bool bForce, SScanLine& scanlineUpdate);
+};
+
 template<typename Func>
 void ForEachScan(SLidarData const& lidar, Func fn) {
     int nAngle = (lidar.m_nIndex - c_nFIRST_LIDAR_INDEX) * 4;
@@ -1,8 +1,12 @@
 #include "scanmatching.h"
 #include "robot_configuration.h"
 #include "occupancy_grid.inl"
+#include "correlative_scan_matcher.h"
+#include "grid_pyramid.h"
 
 #include "icpPointToPoint.h"
+#include "icpPointToPlane.h"
+#include <boost/range/algorithm/find.hpp>
 #include <opencv2/imgproc.hpp>
 
 // #define ENABLE_SCANMATCH_LOG
@@ -29,50 +33,240 @@ void DebugOutputScan(cv::Mat const& matObstacle, std::vector<rbt::point<double>>
 }
 #endif
 
-COccupancyGridWithObstacleList::COccupancyGridWithObstacleList() noexcept : m_iEndSorted(0)  
+namespace {
+    bool Contains(rbt::rect<int> const& rectn, rbt::point<int> const& pt) {
+        return rectn.left<=pt.x && pt.x<=rectn.right && rectn.bottom<=pt.y && pt.y<=rectn.top;
+    }
+
+    // Closest occupied cell from the distance field, and from the obstacle index 
+    // if there is no occupied cell within c_nMaxObstacleDistance or it lies outside the submap
+    double LookupNearestOccupied(COccupancyGridWithObstacleList const& occgrid, rbt::point<double> const& ptf, rbt::rect<int> const& rectnSubmap, rbt::point<int>& ptnNearest) {
+        return occgrid.DistanceField().nearest(rbt::point<int>(std::lround(ptf.x), std::lround(ptf.y)), ptnNearest)
+            && Contains(rectnSubmap, ptnNearest)
+            ? (rbt::point<double>(ptnNearest) - ptf).SqrAbs()
+            : occgrid.NearestOccupied(ptf, rectnSubmap, ptnNearest);
+    }
+
+    // Point to point ICP that queries the obstacle index of the grid 
+    // instead of building a kd-tree from all occupied cells for every fit
+    struct CIcpObstacleIndex : IcpPointToPoint {
+        CIcpObstacleIndex(COccupancyGridWithObstacleList const& occgrid, rbt::rect<int> const& rectnSubmap) 
+            : IcpPointToPoint(2)
+            , m_occgrid(occgrid)
+            , m_rectnSubmap(rectnSubmap)
+        {}
+
+    private:
+        bool hasModel() const override { return true; }
+        double nearestNeighbor(float const* pfQuery, float* pfNearest) const override {
+            rbt::point<int> ptnNearest;
+            auto const fSqrDist = m_occgrid.NearestOccupied(rbt::point<double>(pfQuery[0], pfQuery[1]), m_rectnSubmap, ptnNearest);
+            pfNearest[0] = ptnNearest.x;
+            pfNearest[1] = ptnNearest.y;
+            return fSqrDist;
+        }
+
+        COccupancyGridWithObstacleList const& m_occgrid;
+        rbt::rect<int> m_rectnSubmap;
+    };
+
+    // Point to point ICP that looks up the closest obstacle of the cell containing
+    // the query point in the distance field. Only queries further than c_nMaxObstacleDistance
+    // from any obstacle fall back to the obstacle index.
+    struct CIcpNearestObstacleLookup : IcpPointToPoint {
+        CIcpNearestObstacleLookup(COccupancyGridWithObstacleList const& occgrid, rbt::rect<int> const& rectnSubmap) 
+            : IcpPointToPoint(2)
+            , m_occgrid(occgrid)
+            , m_rectnSubmap(rectnSubmap)
+        {}
+
+    private:
+        bool hasModel() const override { return true; }
+        double nearestNeighbor(float const* pfQuery, float* pfNearest) const override {
+            rbt::point<int> ptnNearest;
+            auto const fSqrDist = LookupNearestOccupied(m_occgrid, rbt::point<double>(pfQuery[0], pfQuery[1]), m_rectnSubmap, ptnNearest);
+            pfNearest[0] = ptnNearest.x;
+            pfNearest[1] = ptnNearest.y;
+            return fSqrDist;
+        }
+
+        COccupancyGridWithObstacleList const& m_occgrid;
+        rbt::rect<int> m_rectnSubmap;
+    };
+
+    // 2D point to line ICP, i.e., libicp's point to plane ICP with the correspondences 
+    // of CIcpNearestObstacleLookup and the normals cached in the grid. 
+    // Where the grid has no normal, the residual is the point to point distance.
+    struct CIcpPointToLine : IcpPointToPlane {
+        CIcpPointToLine(COccupancyGridWithObstacleList const& occgrid, rbt::rect<int> const& rectnSubmap) 
+            : IcpPointToPlane(2)
+            , m_occgrid(occgrid)
+            , m_rectnSubmap(rectnSubmap)
+        {}
+
+    private:
+        bool hasModel() const override { return true; }
+        double nearestNeighborWithNormal(float const* pfQuery, float* pfNearest, float* pfNormal) const override {
+            rbt::point<double> const ptf(pfQuery[0], pfQuery[1]);
+            rbt::point<int> ptnNearest;
+            auto const fSqrDist = LookupNearestOccupied(m_occgrid, ptf, m_rectnSubmap, ptnNearest);
+
+            auto szfNormal = rbt::size<double>::zero();
+            if(!m_occgrid.Normal(ptnNearest, szfNormal) && 0<fSqrDist) {
+                szfNormal = (ptf - rbt::point<double>(ptnNearest)) / std::sqrt(fSqrDist);
+            }
+            pfNearest[0] = ptnNearest.x;
+            pfNearest[1] = ptnNearest.y;
+            pfNormal[0] = szfNormal.x;
+            pfNormal[1] = szfNormal.y;
+            return fSqrDist;
+        }
+
+        COccupancyGridWithObstacleList const& m_occgrid;
+        rbt::rect<int> m_rectnSubmap;
+    };
+}
+
+COccupancyGridWithObstacleList::COccupancyGridWithObstacleList() noexcept
+    : m_gridnObstacle(128)
+    , m_rectnDirty(rbt::rect<int>::empty())
+    , m_gridnNormal(c_nNoNormal)
+    , m_rectnNormalInvalid(rbt::rect<int>::empty())
 {}
 
 COccupancyGridWithObstacleList::COccupancyGridWithObstacleList(COccupancyGridWithObstacleList const& occgrid) noexcept
     : COccupancyGridBaseT(occgrid)
-    , m_vecptfOccupied(occgrid.m_vecptfOccupied)
-    , m_iEndSorted(occgrid.m_iEndSorted)
+    , m_dirvecptOccupied(occgrid.m_dirvecptOccupied)
+    , m_gridnObstacle(occgrid.m_gridnObstacle)
+    , m_rectnDirty(occgrid.m_rectnDirty)
+    , m_distfield(occgrid.m_distfield)
+    , m_tablesCorrelative(occgrid.m_tablesCorrelative)
+    , m_gridnNormal(occgrid.m_gridnNormal)
+    , m_rectnNormalInvalid(occgrid.m_rectnNormalInvalid)
 {}
 
 COccupancyGridWithObstacleList::COccupancyGridWithObstacleList(COccupancyGridWithObstacleList&& occgrid) noexcept
     : COccupancyGridBaseT(std::move(occgrid))
-    , m_vecptfOccupied(std::move(occgrid.m_vecptfOccupied))
-    , m_iEndSorted(occgrid.m_iEndSorted)
+    , m_dirvecptOccupied(std::move(occgrid.m_dirvecptOccupied))
+    , m_gridnObstacle(std::move(occgrid.m_gridnObstacle))
+    , m_rectnDirty(occgrid.m_rectnDirty)
+    , m_distfield(std::move(occgrid.m_distfield))
+    , m_tablesCorrelative(std::move(occgrid.m_tablesCorrelative))
+    , m_gridnNormal(std::move(occgrid.m_gridnNormal))
+    , m_rectnNormalInvalid(occgrid.m_rectnNormalInvalid)
 {}
 
 COccupancyGridWithObstacleList& COccupancyGridWithObstacleList::operator=(COccupancyGridWithObstacleList const& occgrid) noexcept {
     COccupancyGridBaseT::operator=(occgrid);
-    m_vecptfOccupied = occgrid.m_vecptfOccupied;
-    m_iEndSorted = occgrid.m_iEndSorted;
+    m_dirvecptOccupied = occgrid.m_dirvecptOccupied;
+    m_gridnObstacle = occgrid.m_gridnObstacle;
+    m_rectnDirty = occgrid.m_rectnDirty;
+    m_distfield = occgrid.m_distfield;
+    m_tablesCorrelative = occgrid.m_tablesCorrelative;
+    m_gridnNormal = occgrid.m_gridnNormal;
+    m_rectnNormalInvalid = occgrid.m_rectnNormalInvalid;
     return *this;
 }
 
 COccupancyGridWithObstacleList& COccupancyGridWithObstacleList::operator=(COccupancyGridWithObstacleList&& occgrid) noexcept {
     COccupancyGridBaseT::operator=(std::move(occgrid));
-    m_vecptfOccupied = std::move(occgrid.m_vecptfOccupied);
-    m_iEndSorted = occgrid.m_iEndSorted;
+    m_dirvecptOccupied = std::move(occgrid.m_dirvecptOccupied);
+    m_gridnObstacle = std::move(occgrid.m_gridnObstacle);
+    m_rectnDirty = occgrid.m_rectnDirty;
+    m_distfield = std::move(occgrid.m_distfield);
+    m_tablesCorrelative = std::move(occgrid.m_tablesCorrelative);
+    m_gridnNormal = std::move(occgrid.m_gridnNormal);
+    m_rectnNormalInvalid = occgrid.m_rectnNormalInvalid;
     return *this;
 }
 
-rbt::pose<double> COccupancyGridWithObstacleList::fit(rbt::pose<double> const& poseWorld, SScanLine const& scanline) {
-    if(m_iEndSorted<m_vecptfOccupied.size()) {
-        auto itptfEndSorted = m_vecptfOccupied.begin()+m_iEndSorted;
-        std::sort(itptfEndSorted, m_vecptfOccupied.end());
-        m_vecptfOccupied.erase(std::unique(itptfEndSorted, m_vecptfOccupied.end()), m_vecptfOccupied.end());
-        std::inplace_merge(m_vecptfOccupied.begin(), itptfEndSorted, m_vecptfOccupied.end());
-        m_iEndSorted = m_vecptfOccupied.size();
+std::size_t COccupancyGridWithObstacleList::OccupiedCount(rbt::rect<int> const& rectnSubmap) const {
+    std::size_t cpt = 0;
+    ForEachOccupied(rectnSubmap, [&](rbt::point<int> const&) { ++cpt; });
+    return cpt;
+}
+
+double COccupancyGridWithObstacleList::NearestOccupied(rbt::point<double> const& ptf, rbt::rect<int> const& rectnSubmap, rbt::point<int>& ptnNearest) const {
+    using TDirectory = decltype(m_dirvecptOccupied);
+    double fSqrDistBest = std::numeric_limits<double>::max();
+
+    // Buckets overlapping both the directory and the submap
+    auto const& rectnDirectory = m_dirvecptOccupied.TileBounds();
+    auto const ptnBucketMin = TDirectory::TileCoordinate(rbt::point<int>(rectnSubmap.left, rectnSubmap.bottom));
+    auto const ptnBucketMax = TDirectory::TileCoordinate(rbt::point<int>(rectnSubmap.right, rectnSubmap.top));
+    rbt::rect<int> const rectnBuckets{
+        std::max(rectnDirectory.left, ptnBucketMin.x), std::max(rectnDirectory.bottom, ptnBucketMin.y),
+        std::min(rectnDirectory.right, ptnBucketMax.x), std::min(rectnDirectory.top, ptnBucketMax.y)
+    };
+    if(rectnBuckets.right<rectnBuckets.left || rectnBuckets.top<rectnBuckets.bottom) return fSqrDistBest;
+
+    auto SearchBucket = [&](int x, int y) {
+        if(auto const* pvecpt = m_dirvecptOccupied.tile(rbt::point<int>(x, y))) {
+            boost::for_each(*pvecpt, [&](rbt::point<int> const& pt) {
+                auto const fSqrDist = (rbt::point<double>(pt) - ptf).SqrAbs();
+                if(fSqrDist<fSqrDistBest && Contains(rectnSubmap, pt)) {
+                    fSqrDistBest = fSqrDist;
+                    ptnNearest = pt;
+                }
+            });
+        }
+    };
+
+    auto const ptnBucket = TDirectory::TileCoordinate(
+        rbt::point<int>(static_cast<int>(std::floor(ptf.x)), static_cast<int>(std::floor(ptf.y)))
+    );
+    int const nRingMax = std::max(
+        std::max(std::abs(ptnBucket.x - rectnBuckets.left), std::abs(rectnBuckets.right - ptnBucket.x)),
+        std::max(std::abs(ptnBucket.y - rectnBuckets.bottom), std::abs(rectnBuckets.top - ptnBucket.y))
+    );
+    SearchBucket(ptnBucket.x, ptnBucket.y);
+    for(int nRing = 1; nRing<=nRingMax; ++nRing) {
+        // The rings < nRing cover the cells in [(ptnBucket - nRing + 1) * extent, (ptnBucket + nRing) * extent - 1]. 
+        // Cells in ring nRing and beyond are at least fDistMin away. 
+        double const fDistMin = std::min(
+            std::min(ptf.x - ((ptnBucket.x - nRing + 1) * c_nObstacleBucketExtent - 1), (ptnBucket.x + nRing) * c_nObstacleBucketExtent - ptf.x),
+            std::min(ptf.y - ((ptnBucket.y - nRing + 1) * c_nObstacleBucketExtent - 1), (ptnBucket.y + nRing) * c_nObstacleBucketExtent - ptf.y)
+        );
+        if(fSqrDistBest <= fDistMin*fDistMin) break;
+
+        // Visit the buckets of the ring that lie within the directory
+        int const nLeft = std::max(ptnBucket.x - nRing, rectnBuckets.left);
+        int const nRight = std::min(ptnBucket.x + nRing, rectnBuckets.right);
+        for(int y : {ptnBucket.y - nRing, ptnBucket.y + nRing}) {
+            if(y<rectnBuckets.bottom || rectnBuckets.top<y) continue;
+            for(int x = nLeft; x<=nRight; ++x) SearchBucket(x, y);
+        }
+        int const nBottom = std::max(ptnBucket.y - nRing + 1, rectnBuckets.bottom);
+        int const nTop = std::min(ptnBucket.y + nRing - 1, rectnBuckets.top);
+        for(int x : {ptnBucket.x - nRing, ptnBucket.x + nRing}) {
+            if(x<rectnBuckets.left || rectnBuckets.right<x) continue;
+            for(int y = nBottom; y<=nTop; ++y) SearchBucket(x, y);
+        }
     }
-    
-    if(m_vecptfOccupied.size()<10) return poseWorld;
-    
+    return fSqrDistBest;
+}
+
+rbt::pose<double> COccupancyGridWithObstacleList::fit(rbt::pose<double> const& poseWorld, SScanLine const& scanline, EScanMatcher escanmatcher) {
     std::vector<rbt::point<double>> vecptfTemplate;
+    auto rectnSubmap = rbt::rect<int>::empty();
     boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
-        vecptfTemplate.emplace_back(ToGridCoordinate(Obstacle(poseWorld, scan.m_fRadAngle, scan.m_nDistance)));
+        auto const ptn = ToGridCoordinate(Obstacle(poseWorld, scan.m_fRadAngle, scan.m_nDistance));
+        vecptfTemplate.emplace_back(ptn);
+        rectnSubmap |= ptn;
     });
+    if(vecptfTemplate.empty()) return poseWorld;
+
+    // Only obstacles around the scan can be matched, so match against the local submap
+    rectnSubmap = rbt::rect<int>{
+        rectnSubmap.left - c_nSubmapMargin, rectnSubmap.bottom - c_nSubmapMargin,
+        rectnSubmap.right + c_nSubmapMargin, rectnSubmap.top + c_nSubmapMargin
+    };
+    if(OccupiedCount(rectnSubmap)<10) return poseWorld;
+
+    if(escanmatcherCORRELATIVE==escanmatcher) {
+        UpdateCorrelativeTables(c_nCorrelativeLevels);
+        return CorrelativeScanMatch(poseWorld, scanline, m_tablesCorrelative);
+    }
         
 #ifdef ENABLE_SCANMATCH_LOG
     static int c_nCount = 0;
@@ -92,8 +286,19 @@ rbt::pose<double> COccupancyGridWithObstacleList::fit(rbt::pose<double> const& p
     static_assert(sizeof(rbt::point<double>)==2*sizeof(double), "");
         
     // Use libicp, an iterative closest point implementation (http://www.cvlibs.net/software/libicp/)
-    IcpPointToPoint icp(&m_vecptfOccupied[0].x, m_vecptfOccupied.size(), 2);
-    icp.fit(&vecptfTemplate[0].x,vecptfTemplate.size(), R, t, 250);
+    if(escanmatcherICP_POINT_TO_LINE==escanmatcher) {
+        UpdateDistanceField();
+        UpdateNormals();
+        CIcpPointToLine icp(*this, rectnSubmap);
+        icp.fit(&vecptfTemplate[0].x,vecptfTemplate.size(), R, t, 250);
+    } else if(escanmatcherICP_LOOKUP==escanmatcher) {
+        UpdateDistanceField();
+        CIcpNearestObstacleLookup icp(*this, rectnSubmap);
+        icp.fit(&vecptfTemplate[0].x,vecptfTemplate.size(), R, t, 250);
+    } else {
+        CIcpObstacleIndex icp(*this, rectnSubmap);
+        icp.fit(&vecptfTemplate[0].x,vecptfTemplate.size(), R, t, 250);
+    }
     
 #ifdef ENABLE_SCANMATCH_LOG
     LOG("ICP: R = " << R << " t = " << t);
@@ -128,41 +333,170 @@ rbt::pose<double> COccupancyGridWithObstacleList::fit(rbt::pose<double> const& p
     return poseWorldCorrected;
 }
 
+void COccupancyGridWithObstacleList::updateObstacleMap(rbt::point<int> const& pt, std::uint8_t nColor) {
+    // Don't copy shared tiles if nothing changes
+    auto const nColorPrev = m_gridnObstacle.at(pt);
+    if(nColor!=nColorPrev) {
+        m_gridnObstacle.ref(pt) = nColor;
+        m_rectnDirty |= pt;
+        if(0==nColor || 0==nColorPrev) { // obstacle added or removed
+            m_distfield.invalidate(pt);
+            m_tablesCorrelative.invalidate(pt);
+            m_rectnNormalInvalid |= pt;
+        }
+    }
+}
+
+bool COccupancyGridWithObstacleList::Normal(rbt::point<int> const& pt, rbt::size<double>& szfNormal) const {
+    auto const nDegree = m_gridnNormal.at(pt);
+    if(c_nNoNormal==nDegree) return false;
+    szfNormal = rbt::size<double>::fromAngleAndDistance(rbt::rad(nDegree), 1);
+    return true;
+}
+
+void COccupancyGridWithObstacleList::UpdateCorrelativeTables(int cLevels) {
+    UpdateDistanceField();
+    m_tablesCorrelative.update(m_distfield, cLevels);
+}
+
+void COccupancyGridWithObstacleList::UpdateNormals() {
+    if(m_rectnNormalInvalid.right<m_rectnNormalInvalid.left) return; // nothing changed
+
+    // A changed obstacle affects the normals of the occupied cells within c_nNormalRadius
+    rbt::rect<int> const rectnUpdate{
+        m_rectnNormalInvalid.left - c_nNormalRadius, m_rectnNormalInvalid.bottom - c_nNormalRadius, 
+        m_rectnNormalInvalid.right + c_nNormalRadius, m_rectnNormalInvalid.top + c_nNormalRadius
+    };
+    for(int y = rectnUpdate.bottom; y <= rectnUpdate.top; ++y) {
+        for(int x = rectnUpdate.left; x <= rectnUpdate.right; ++x) {
+            rbt::point<int> const pt(x, y);
+            auto nDegree = c_nNoNormal;
+            if(0==m_gridnObstacle.at(pt)) {
+                // Principal axes of the occupied cells around pt
+                int cpt = 0;
+                double fSumX = 0, fSumY = 0, fSumXX = 0, fSumYY = 0, fSumXY = 0;
+                for(int dy = -c_nNormalRadius; dy <= c_nNormalRadius; ++dy) {
+                    for(int dx = -c_nNormalRadius; dx <= c_nNormalRadius; ++dx) {
+                        if(0!=m_gridnObstacle.at(pt + rbt::size<int>(dx, dy))) continue;
+                        ++cpt;
+                        fSumX += dx; fSumY += dy;
+                        fSumXX += dx*dx; fSumYY += dy*dy; fSumXY += dx*dy;
+                    }
+                }
+                if(3<=cpt) {
+                    double const fCovXX = fSumXX/cpt - rbt::sqr(fSumX/cpt);
+                    double const fCovYY = fSumYY/cpt - rbt::sqr(fSumY/cpt);
+                    double const fCovXY = fSumXY/cpt - (fSumX/cpt)*(fSumY/cpt);
+                    double const fMean = (fCovXX + fCovYY)/2;
+                    double const fDeviation = std::sqrt(rbt::sqr((fCovXX - fCovYY)/2) + rbt::sqr(fCovXY));
+                    // Only accept line-shaped neighborhoods, the minor axis variance must be small
+                    if(3*(fMean - fDeviation) < fMean + fDeviation) {
+                        double const fRadLine = std::atan2(2*fCovXY, fCovXX - fCovYY)/2;
+                        int const nDegreeNormal = static_cast<int>(std::lround((fRadLine + M_PI/2) * 180 / M_PI));
+                        nDegree = static_cast<std::uint8_t>(((nDegreeNormal % 180) + 180) % 180);
+                    }
+                }
+            }
+            // Don't copy shared tiles if nothing changes
+            if(nDegree!=m_gridnNormal.at(pt)) m_gridnNormal.ref(pt) = nDegree;
+        }
+    }
+    m_rectnNormalInvalid = rbt::rect<int>::empty();
+}
+
+void COccupancyGridWithObstacleList::rebuildObstacleMap() {
+    auto const nThreshold = log_odds_traits::FromDouble(c_fFreeThreshold);
+    m_gridLogOdds.ForEachTile([&](rbt::point<int> const& ptOrigin, std::int16_t const* pn) {
+        for(int y = 0; y<c_nTileExtent; ++y) {
+            m_gridnObstacle.ModifyRow(ptOrigin + rbt::size<int>(0, y), c_nTileExtent, [&](rbt::point<int> const&, std::uint8_t* pb, int cn) {
+                ThresholdLogOdds(pn + y*c_nTileExtent, pb, cn, nThreshold);
+            });
+        }
+    });
+
+    auto const rectn = m_gridLogOdds.bounds();
+    if(rectn.right<rectn.left) return; // empty grid
+    for(auto const& pt : {rbt::point<int>(rectn.left, rectn.bottom), rbt::point<int>(rectn.right, rectn.top)}) {
+        m_rectnDirty |= pt;
+        m_distfield.invalidate(pt);
+        m_tablesCorrelative.invalidate(pt);
+        m_rectnNormalInvalid |= pt;
+    }
+    UpdateDistanceField();
+}
+
+void COccupancyGridWithObstacleList::updateGridPoly(std::vector<rbt::point<int>> const& rngpt, double fOdds) {
+    // The robot's footprint is always free, see internalUpdatePerPose
+    boost::for_each(RasterizeConvexPolygon(rngpt), [&](rbt::point<int> const& pt) {
+        updateObstacleMap(pt, 255);
+    });
+}
+
 void COccupancyGridWithObstacleList::updateGrid(rbt::point<int> const& pt, double fOdds) {
-    auto itptfEndSorted =m_vecptfOccupied.begin()+m_iEndSorted;
-    rbt::point<double> const ptf(pt);
-    auto itpt = std::lower_bound(m_vecptfOccupied.begin(), itptfEndSorted, ptf);
+    updateObstacleMap(
+        pt,
+        c_fFreeThreshold<fOdds
+            ? 0 // occupied
+            : (fOdds < -c_fFreeThreshold ? 255 : 128)
+    );
+
+    // Look at the shared bucket first, only copy it if the obstacle list changes
+    auto const ptTile = decltype(m_dirvecptOccupied)::TileCoordinate(pt);
+    auto const* pvecpt = m_dirvecptOccupied.tile(ptTile);
+    bool const bListed = pvecpt && pvecpt->end()!=boost::find(*pvecpt, pt);
+
     if(c_fFreeThreshold<fOdds) { // occupied point
-        if(itpt==m_vecptfOccupied.end() || *itpt!=ptf) {
-            m_vecptfOccupied.emplace_back(pt);
+        if(!bListed) {
+            m_dirvecptOccupied.mutable_tile(ptTile, [](std::vector<rbt::point<int>>&) {}).emplace_back(pt);
         }
     } else { // free point
-        if(itpt!=m_vecptfOccupied.end() && *itpt==ptf) {
-            std::swap(*itpt, *boost::prior(itptfEndSorted));
-            m_iEndSorted=itpt-m_vecptfOccupied.begin()+1;
+        if(bListed) {
+            auto& vecpt = m_dirvecptOccupied.mutable_tile(ptTile, [](std::vector<rbt::point<int>>&) {});
+            auto itpt = boost::find(vecpt, pt);
+            std::swap(*itpt, vecpt.back());
+            vecpt.pop_back();
         }
     }
 }
 
 cv::Mat COccupancyGridWithObstacleList::ObstacleMap() const {
-    cv::Mat matnMapLogOdds;
-    m_matfMapLogOdds.convertTo(matnMapLogOdds, CV_8U, /*alpha*/ -1, 128);
-    // p = 1/(1 + exp(fOdds))
-    // So fOdds = 0 means p = 0.5, less means probably free space, higher means probably occupied
+    return ObstacleMap(c_rectnMapWindow);
+}
 
-    // In matnMapLogOdds, each pixel is -1 * fOdds + 128, so p = 0.5 is color 128, 
-    // less means probably occupied, higher means probably free. 
-    
-    cv::Mat matn; 
-    // Set everything to 0 that is < 127, leave rest as is
-    cv::threshold(matnMapLogOdds, matn, 128-c_fFreeThreshold-1, /*ignored*/ 255, cv::THRESH_TOZERO);
+cv::Mat COccupancyGridWithObstacleList::ObstacleMap(rbt::rect<int> const& rectn) const {
+    return m_gridnObstacle.ToMat(rectn);
+}
 
-    cv::Mat matnFree; 
-    // Set everything to 255 that is > 129, everything else to 0
-    cv::threshold(matnMapLogOdds, matnFree, 128+c_fFreeThreshold, 255.0, cv::THRESH_BINARY);
-    
-    matnFree.copyTo(matn, /*mask*/ matnFree);
-    return matn;
+void COccupancyGridWithObstacleList::UpdateObstacleMap(cv::Mat& matn, rbt::rect<int> const& rectnWindow) const {
+    ASSERT(matn.type()==CV_8UC1);
+    ASSERT(matn.cols==rectnWindow.right - rectnWindow.left + 1 && matn.rows==rectnWindow.top - rectnWindow.bottom + 1);
+
+    rbt::rect<int> const rectn{
+        std::max(m_rectnDirty.left, rectnWindow.left),
+        std::max(m_rectnDirty.bottom, rectnWindow.bottom),
+        std::min(m_rectnDirty.right, rectnWindow.right),
+        std::min(m_rectnDirty.top, rectnWindow.top)
+    };
+    if(rectn.right<rectn.left || rectn.top<rectn.bottom) return;
+
+    m_gridnObstacle.ToMat(rectn).copyTo(
+        matn(cv::Rect(
+            rectn.left - rectnWindow.left, 
+            rectn.bottom - rectnWindow.bottom, 
+            rectn.right - rectn.left + 1, 
+            rectn.top - rectn.bottom + 1
+        ))
+    );
+}
+
+std::vector<cv::Mat> COccupancyGridWithObstacleList::ObstacleMapPyramid(rbt::rect<int> const& rectnWindow) const {
+    // Only path finding uses the pyramid, so it is pooled from the rendered window on demand
+    // instead of being kept up to date in every particle's map
+    std::vector<cv::Mat> vecmatn{ObstacleMap(rectnWindow)};
+    for(int nLevel = 1; nLevel<=c_nPyramidLevels; ++nLevel) {
+        vecmatn.emplace_back(MinPool2x2<std::uint8_t>(vecmatn.back(), 128));
+    }
+    return vecmatn;
 }
 
 cv::Mat COccupancyGridWithObstacleList::ObstacleMapWithPoses(std::vector<rbt::pose<double>> const& vecpose) const {
@@ -180,10 +514,8 @@ void CScanMatchingBase::receivedSensorData(SScanLine const& scanline) {
         m_vecpose.back().m_fYaw + scanline.rotation() 
     );
     
-    m_vecpose.emplace_back(m_occgrid.fit(poseNewCandidate, scanline));
-    boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
-        m_occgrid.update(m_vecpose.back(), scan.m_fRadAngle, scan.m_nDistance);
-    });
+    m_vecpose.emplace_back(m_occgrid.fit(poseNewCandidate, scanline.downsampled()));
+    m_occgrid.update(m_vecpose.back(), scanline);
 }
 
 cv::Mat CScanMatchingBase::getMap() const {
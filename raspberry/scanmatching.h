@@ -3,37 +3,132 @@
 #include "nonmoveable.h"
 #include "geometry.h"
 #include "occupancy_grid.h"
+#include "robot_configuration.h"
 #include "scanline.h"
+#include "correlative_scan_matcher.h"
 
+#include <limits>
 #include <vector>
 #include <opencv2/core.hpp>
 #include <boost/range/iterator_range.hpp>
 
+int constexpr c_nObstacleBucketExtent = 16; // px, extent of the buckets in the obstacle index
+int constexpr c_nSubmapMargin = 20; // px, fit() matches against the obstacles within this margin around the scan
+int constexpr c_nNormalRadius = 2; // px, normals are estimated from the occupied cells in a 5 x 5 window
+std::uint8_t constexpr c_nNoNormal = 255;
+
+// Scan matching algorithm used by COccupancyGridWithObstacleList::fit
+enum EScanMatcher {
+    escanmatcherICP, // point to point ICP, correspondences from the obstacle index
+    escanmatcherICP_LOOKUP, // point to point ICP, correspondences looked up in the distance field
+    escanmatcherCORRELATIVE, // branch and bound search, see correlative_scan_matcher.h
+    escanmatcherICP_POINT_TO_LINE // point to line ICP with the cached normals of the occupied cells
+};
+
 // Build an occupancy grid map based on scan matching. 
 // Instead of relying on the odometry data alone, 
 // this algorithm estimates the robot position by matching 
 // the measured obstacles in each SScanLine against the 
 // existing occupancy grid.
-struct COccupancyGridWithObstacleList : COccupancyGridBaseT<COccupancyGridWithObstacleList> {
+// The log odds are stored as fixed-point std::int16_t, because the grid
+// is copied for every particle in CFastParticleSlamBase.
+struct COccupancyGridWithObstacleList : COccupancyGridBaseT<COccupancyGridWithObstacleList, std::int16_t> {
     COccupancyGridWithObstacleList() noexcept;
     COccupancyGridWithObstacleList(COccupancyGridWithObstacleList const& occgrid) noexcept;
     COccupancyGridWithObstacleList(COccupancyGridWithObstacleList&& occgrid) noexcept;
     COccupancyGridWithObstacleList& operator=(COccupancyGridWithObstacleList const& occgrid) noexcept;
     COccupancyGridWithObstacleList& operator=(COccupancyGridWithObstacleList&& occgrid) noexcept;
 
-    rbt::pose<double> fit(rbt::pose<double> const& poseWorld, SScanLine const& scanline);
+    rbt::pose<double> fit(rbt::pose<double> const& poseWorld, SScanLine const& scanline, EScanMatcher escanmatcher = escanmatcherICP);
+
+    // Local submap queries. Only the buckets of the obstacle index overlapping rectnSubmap
+    // are visited, so the cost does not grow with the size of the map.
 
+    // Calls fn(rbt::point<int> const& pt) for every occupied cell in rectnSubmap
+    template<typename Func>
+    void ForEachOccupied(rbt::rect<int> const& rectnSubmap, Func fn) const;
+    std::size_t OccupiedCount(rbt::rect<int> const& rectnSubmap) const;
+    // Nearest occupied cell in rectnSubmap to ptf in grid coordinates. Searches the obstacle index 
+    // in rings of buckets around ptf until no closer cell can be found. Returns the squared distance,
+    // or std::numeric_limits<double>::max() if there are no occupied cells in rectnSubmap.
+    double NearestOccupied(rbt::point<double> const& ptf, rbt::rect<int> const& rectnSubmap, rbt::point<int>& ptnNearest) const;
+
+    // Renders the map window c_rectnMapWindow
     cv::Mat ObstacleMap() const;
+    cv::Mat ObstacleMap(rbt::rect<int> const& rectn) const;
     cv::Mat ObstacleMapWithPoses(std::vector<rbt::pose<double>> const& vecpose) const;
 
-    friend struct COccupancyGridBaseT<COccupancyGridWithObstacleList>;
+    // Bounding rectangle of the obstacle map cells that changed since the last call to ClearDirtyRect()
+    rbt::rect<int> const& DirtyRect() const { return m_rectnDirty; }
+    void ClearDirtyRect() { m_rectnDirty = rbt::rect<int>::empty(); }
+    // Copies the changed cells into matn, which renders the map window rectnWindow
+    void UpdateObstacleMap(cv::Mat& matn, rbt::rect<int> const& rectnWindow) const;
+
+    // Distance field of the occupied cells, valid after UpdateDistanceField()
+    CDistanceField const& DistanceField() const { return m_distfield; }
+    void UpdateDistanceField() { m_distfield.update(m_gridnObstacle); }
+
+    // Lookup tables of the correlative scan matcher, valid after UpdateCorrelativeTables(cLevels).
+    // Only maintained while a correlative search needs them.
+    CCorrelativeTables const& CorrelativeTables() const { return m_tablesCorrelative; }
+    void UpdateCorrelativeTables(int cLevels);
+
+    // Unit normal of the wall through the occupied cell pt, estimated from the occupied cells
+    // within c_nNormalRadius. False if pt is free or its neighborhood is not line-shaped.
+    // Valid after UpdateNormals(), normals are only recomputed around changed obstacles.
+    bool Normal(rbt::point<int> const& pt, rbt::size<double>& szfNormal) const;
+    void UpdateNormals();
+
+    // Renders the map window rectnWindow and min-pools it to all pyramid levels, see MinPool2x2.
+    // rectnWindow.left and rectnWindow.bottom must be multiples of 2^c_nPyramidLevels.
+    std::vector<cv::Mat> ObstacleMapPyramid(rbt::rect<int> const& rectnWindow) const;
+
+    friend struct COccupancyGridBaseT<COccupancyGridWithObstacleList, std::int16_t>;
+    // updateGrid distinguishes occupied, free and unknown cells
+    static constexpr double c_fObstacleThreshold = c_fFreeThreshold;
     void updateGrid(rbt::point<int> const& pt, double fOdds);
-    void updateGridPoly(std::vector<rbt::point<int>> const& rngpt, double fOdds) {}
+    void updateGridPoly(std::vector<rbt::point<int>> const& rngpt, double fOdds);
 
 private:
-    std::vector<rbt::point<double>> m_vecptfOccupied;
-    std::size_t m_iEndSorted;
+    friend bool SaveMapSnapshot(std::string const& strFile, COccupancyGridWithObstacleList const& occgrid, std::vector<rbt::pose<double>> const& vecpose);
+    friend bool LoadMapSnapshot(std::string const& strFile, COccupancyGridWithObstacleList& occgrid, std::vector<rbt::pose<double>>& vecpose);
+
+    void updateObstacleMap(rbt::point<int> const& pt, std::uint8_t nColor);
+    // Recomputes the obstacle map and distance field from the log odds
+    void rebuildObstacleMap();
+
+    // Occupied cells grouped into buckets of c_nObstacleBucketExtent x c_nObstacleBucketExtent cells.
+    // Spatial index for the nearest neighbor queries in fit(), updated in updateGrid. 
+    // Like the log odds, the per-bucket lists are copy-on-write and shared between copies of the grid.
+    CTileDirectory<std::vector<rbt::point<int>>, c_nObstacleBucketExtent> m_dirvecptOccupied;
+
+    // Obstacle map kept up to date in updateGrid: 0 is occupied, 255 is free, 128 is unknown
+    CTiledGrid<std::uint8_t> m_gridnObstacle;
+    rbt::rect<int> m_rectnDirty;
+    CDistanceField m_distfield;
+    CCorrelativeTables m_tablesCorrelative;
+    // Normal angle in degrees [0, 180) of every occupied cell, c_nNoNormal otherwise
+    CTiledGrid<std::uint8_t> m_gridnNormal;
+    rbt::rect<int> m_rectnNormalInvalid;
 };
+
+template<typename Func>
+void COccupancyGridWithObstacleList::ForEachOccupied(rbt::rect<int> const& rectnSubmap, Func fn) const {
+    using TDirectory = decltype(m_dirvecptOccupied);
+    auto const ptnBucketMin = TDirectory::TileCoordinate(rbt::point<int>(rectnSubmap.left, rectnSubmap.bottom));
+    auto const ptnBucketMax = TDirectory::TileCoordinate(rbt::point<int>(rectnSubmap.right, rectnSubmap.top));
+    for(int y = ptnBucketMin.y; y <= ptnBucketMax.y; ++y) {
+        for(int x = ptnBucketMin.x; x <= ptnBucketMax.x; ++x) {
+            if(auto const* pvecpt = m_dirvecptOccupied.tile(rbt::point<int>(x, y))) {
+                boost::for_each(*pvecpt, [&](rbt::point<int> const& pt) {
+                    if(rectnSubmap.left<=pt.x && pt.x<=rectnSubmap.right && rectnSubmap.bottom<=pt.y && pt.y<=rectnSubmap.top) {
+                        fn(pt);
+                    }
+                });
+            }
+        }
+    }
+}
  
 struct CScanMatchingBase : rbt::nonmoveable {
     CScanMatchingBase();
@@ -0,0 +1,122 @@
+#include "thread_pool.h"
+#include "error_handling.h"
+
+#include <cassert>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+CThreadPool::CThreadPool(int cThreads)
+    : m_bStop(false)
+{
+    ASSERT(0<cThreads);
+#ifdef _OPENMP
+    // The creating thread usually takes part in parallel_for as well
+    omp_set_num_threads(1);
+#endif
+    for(int i = 1; i < cThreads; ++i) {
+        m_vecthread.emplace_back([this] { run(); });
+    }
+}
+
+CThreadPool::~CThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_bStop = true;
+    }
+    m_cv.notify_all();
+    for(auto& thread : m_vecthread) thread.join();
+}
+
+void CThreadPool::submit(std::function<void()> fn) {
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_deqfn.emplace_back(std::move(fn));
+    }
+    m_cv.notify_one();
+}
+
+void CThreadPool::run() {
+#ifdef _OPENMP
+    omp_set_num_threads(1);
+#endif
+    for(;;) {
+        std::function<void()> fn;
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cv.wait(lock, [&] { return m_bStop || !m_deqfn.empty(); });
+            if(m_deqfn.empty()) return; // m_bStop
+            fn = std::move(m_deqfn.front());
+            m_deqfn.pop_front();
+        }
+        fn();
+    }
+}
+
+CBackgroundWorker::CBackgroundWorker()
+    : m_bBusy(false)
+    , m_bStop(false)
+    , m_thread([this] { loop(); })
+{}
+
+CBackgroundWorker::~CBackgroundWorker() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_bStop = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+void CBackgroundWorker::run(std::function<void()> fn) {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_fn = std::move(fn);
+        m_bBusy = true;
+    }
+    m_cv.notify_all();
+}
+
+void CBackgroundWorker::wait() const {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_cv.wait(lock, [&] { return !m_bBusy; });
+}
+
+void CBackgroundWorker::loop() {
+    for(;;) {
+        std::function<void()> fn;
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cv.wait(lock, [&] { return m_bStop || m_fn; });
+            if(!m_fn) return; // m_bStop
+            fn = std::move(m_fn);
+            m_fn = nullptr;
+        }
+        fn();
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_bBusy = false;
+        }
+        m_cv.notify_all();
+    }
+}
+
+namespace {
+    int s_cThreads = 0;
+}
+
+void ConfigureThreadPool(int cThreads) {
+    s_cThreads = cThreads;
+}
+
+CThreadPool& ThreadPool() {
+    static CThreadPool s_threadpool(
+        0<s_cThreads
+            ? s_cThreads
+            : std::max(1, static_cast<int>(std::thread::hardware_concurrency()))
+    );
+    return s_threadpool;
+}
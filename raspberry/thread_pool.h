@@ -0,0 +1,94 @@
+#pragma once
+
+#include "nonmoveable.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads processing a task queue. Replaces starting one
+// std::async thread per particle for every scan line.
+//
+// Workers and the thread creating the pool run libicp's OpenMP loops single-threaded,
+// the pool already keeps all cores busy with independent particles.
+struct CThreadPool : rbt::nonmoveable {
+    // cThreads includes the thread calling parallel_for, which works as well
+    explicit CThreadPool(int cThreads);
+    ~CThreadPool();
+
+    int ThreadCount() const { return static_cast<int>(m_vecthread.size()) + 1; }
+
+    // Calls fn(i) for all i in [0, c) and returns when all calls are done. Indices are
+    // handed out one by one, so threads that finish cheap calls early pick up more work.
+    // Must not be called from within fn.
+    template<typename Func>
+    void parallel_for(std::size_t c, Func fn);
+
+private:
+    void submit(std::function<void()> fn);
+    void run();
+
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::deque<std::function<void()>> m_deqfn;
+    bool m_bStop;
+    std::vector<std::thread> m_vecthread;
+};
+
+// Single persistent thread running one task at a time in the background, e.g. the pipelined
+// map update of CFastParticleSlamBase, instead of starting a thread per task with std::async.
+// It is not part of CThreadPool, so its tasks may call ThreadPool().parallel_for.
+struct CBackgroundWorker : rbt::nonmoveable {
+    CBackgroundWorker();
+    ~CBackgroundWorker(); // waits for the current task
+
+    // Waits for the previous task and runs fn on the worker thread
+    void run(std::function<void()> fn);
+    // Returns when the current task is done
+    void wait() const;
+
+private:
+    void loop();
+
+    mutable std::mutex m_mtx;
+    mutable std::condition_variable m_cv;
+    std::function<void()> m_fn; // task waiting to be started
+    bool m_bBusy; // a task is waiting or running
+    bool m_bStop;
+    std::thread m_thread; // declared last, starts after the other members are initialized
+};
+
+// Process-wide pool used by the SLAM implementations. ConfigureThreadPool must
+// be called before the first call to ThreadPool(), otherwise the pool uses
+// std::thread::hardware_concurrency() threads.
+void ConfigureThreadPool(int cThreads);
+CThreadPool& ThreadPool();
+
+template<typename Func>
+void CThreadPool::parallel_for(std::size_t c, Func fn) {
+    std::atomic<std::size_t> i(0);
+    auto Run = [&] {
+        for(std::size_t n = i++; n < c; n = i++) fn(n);
+    };
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::size_t cHelpers = std::min(c, m_vecthread.size());
+    for(std::size_t n = 0, cHelpersSubmitted = cHelpers; n < cHelpersSubmitted; ++n) {
+        submit([&] {
+            Run();
+            std::lock_guard<std::mutex> lock(mtx);
+            if(0==--cHelpers) cv.notify_one();
+        });
+    }
+    Run();
+
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [&] { return 0==cHelpers; });
+}
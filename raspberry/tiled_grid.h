@@ -0,0 +1,362 @@
+#pragma once
+
+#include "geometry.h"
+#include "error_handling.h"
+
+#include <array>
+#include <cassert>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <opencv2/core.hpp>
+
+int constexpr c_nTileExtent = 32; // cells per tile side
+int constexpr c_nBlockExtent = 8; // tiles per block side
+
+// An unbounded 2D directory of tiles covering nTileExtent x nTileExtent cells each.
+// The directory is a two-level tree: A dense array of pointers to blocks over the 
+// bounding rectangle of the allocated tiles, every block holds the pointers to 
+// c_nBlockExtent x c_nBlockExtent tiles.
+//
+// Blocks and tiles are reference-counted and copy-on-write: Copying a directory only 
+// copies the block pointers. When one of the copies modifies a tile, only the block
+// containing it and the tile itself are duplicated. E.g. particles that have been 
+// duplicated during resampling share all unchanged parts of their maps, like the
+// ancestry tree of DP-SLAM (Eliazar, Parr "DP-SLAM 2.0", ICRA 2004). Parts only referenced 
+// by lineages that died out in resampling are freed with the last reference.
+// Memory grows with the map size plus the regions modified by each lineage.
+//
+// nTileExtent can be smaller than c_nTileExtent for directories used as a spatial index.
+template<typename TTile, int nTileExtent = c_nTileExtent>
+struct CTileDirectory {
+    CTileDirectory();
+
+    // Tile coordinate of the tile containing cell pt
+    static rbt::point<int> TileCoordinate(rbt::point<int> const& pt) {
+        return rbt::point<int>(FloorDiv(pt.x, nTileExtent), FloorDiv(pt.y, nTileExtent));
+    }
+    // Index of cell pt inside its tile, tiles are stored in row-major order
+    static int CellIndex(rbt::point<int> const& pt) {
+        auto const ptTile = TileCoordinate(pt);
+        return (pt.y - ptTile.y*nTileExtent)*nTileExtent + (pt.x - ptTile.x*nTileExtent);
+    }
+
+    // nullptr if tile is not allocated
+    TTile const* tile(rbt::point<int> const& ptTile) const;
+    // Allocates the tile using fnInit if necessary.
+    // Clones the tile and its block if they are shared with another directory.
+    template<typename FInit>
+    TTile& mutable_tile(rbt::point<int> const& ptTile, FInit fnInit);
+
+    // Replaces the tile at ptTile, e.g. with a tile that aliases external memory
+    void set_tile(rbt::point<int> const& ptTile, std::shared_ptr<TTile> ptile);
+
+    std::size_t TileCount() const;
+    // Inclusive rectangle in tile coordinates containing all allocated tiles
+    rbt::rect<int> TileBounds() const;
+
+    // Calls fn(rbt::point<int> const& ptTile, TTile const& tile) for every allocated tile
+    template<typename Func>
+    void ForEachTile(Func fn) const;
+
+private:
+    struct SBlock {
+        std::array<std::shared_ptr<TTile>, c_nBlockExtent*c_nBlockExtent> m_aptile; // row-major
+    };
+
+    static int FloorDiv(int n, int nDivisor) { // floor division, also for negative n
+        return n<0 ? (n+1)/nDivisor - 1 : n/nDivisor;
+    }
+    static rbt::point<int> BlockCoordinate(rbt::point<int> const& ptTile) {
+        return rbt::point<int>(FloorDiv(ptTile.x, c_nBlockExtent), FloorDiv(ptTile.y, c_nBlockExtent));
+    }
+    static std::size_t TileIndex(rbt::point<int> const& ptTile) { // index of ptTile in its block
+        auto const ptBlock = BlockCoordinate(ptTile);
+        return (ptTile.y - ptBlock.y*c_nBlockExtent)*c_nBlockExtent + (ptTile.x - ptBlock.x*c_nBlockExtent);
+    }
+
+    bool InDirectory(rbt::point<int> const& ptBlock) const;
+    std::size_t DirectoryIndex(rbt::point<int> const& ptBlock) const;
+    void GrowDirectory(rbt::point<int> const& ptBlock);
+    // Block containing ptTile, allocated or cloned if shared
+    SBlock& mutable_block(rbt::point<int> const& ptTile);
+
+    rbt::rect<int> m_rectnDirectory; // inclusive, in block coordinates
+    std::vector<std::shared_ptr<SBlock>> m_vecpblock; // row-major over m_rectnDirectory
+};
+
+// An unbounded 2D grid of cells of type T stored in copy-on-write tiles.
+// Tiles are allocated when a cell is first written to, reading a cell
+// of an unallocated tile returns the default value.
+// Memory for the cells grows with the area that has actually been written.
+template<typename T>
+struct CTiledGrid {
+    using STile = std::array<T, c_nTileExtent*c_nTileExtent>;
+
+    explicit CTiledGrid(T tDefault);
+
+    // Read access, does not allocate
+    T at(rbt::point<int> const& pt) const;
+    // Write access, allocates the tile containing pt if necessary
+    T& ref(rbt::point<int> const& pt);
+
+    T DefaultValue() const { return m_tDefault; }
+    std::size_t TileCount() const { return m_dirtile.TileCount(); }
+
+    // Replaces the tile at tile coordinate ptTile, e.g. with a tile aliasing a memory-mapped file.
+    // Like every tile, it is copied on write while it is shared.
+    void SetTile(rbt::point<int> const& ptTile, std::shared_ptr<STile> ptile) {
+        m_dirtile.set_tile(ptTile, std::move(ptile));
+    }
+
+    // Bounding rectangle (inclusive) of all allocated tiles in cell coordinates.
+    // rbt::rect<int>::empty() if no cell has been written yet.
+    rbt::rect<int> bounds() const;
+
+    // Copies the cells inside the inclusive rectangle rectn to a cv::Mat
+    // with rectn.left, rectn.bottom at (0, 0)
+    cv::Mat ToMat(rbt::rect<int> const& rectn) const;
+
+    // Calls fn(rbt::point<int> const& ptOrigin, T const* pt) for every allocated tile.
+    // ptOrigin is the cell coordinate of the first cell in the tile, the tile
+    // is stored in row-major order.
+    template<typename Func>
+    void ForEachTile(Func fn) const;
+
+    // Calls fn(rbt::point<int> const& ptBegin, T const* pt, int cn) for every contiguous row
+    // of cn cells that lies inside the inclusive rectangle rectn and inside an allocated tile.
+    // Only the tiles overlapping rectn are looked up.
+    template<typename Func>
+    void ForEachRowSegment(rbt::rect<int> const& rectn, Func fn) const;
+
+    // Calls fn(rbt::point<int> const& ptBegin, T* pt, int cn) for the cells ptBegin to
+    // ptBegin + (cn-1, 0), split into contiguous segments at tile boundaries.
+    // Allocates the tiles if necessary.
+    template<typename Func>
+    void ModifyRow(rbt::point<int> const& ptBegin, int cn, Func fn);
+
+private:
+    T m_tDefault;
+    CTileDirectory<STile> m_dirtile;
+};
+
+////////////////////
+// CTileDirectory
+template<typename TTile, int nTileExtent>
+CTileDirectory<TTile, nTileExtent>::CTileDirectory()
+    : m_rectnDirectory(rbt::rect<int>::empty())
+{}
+
+template<typename TTile, int nTileExtent>
+bool CTileDirectory<TTile, nTileExtent>::InDirectory(rbt::point<int> const& ptBlock) const {
+    return m_rectnDirectory.left<=ptBlock.x && ptBlock.x<=m_rectnDirectory.right
+        && m_rectnDirectory.bottom<=ptBlock.y && ptBlock.y<=m_rectnDirectory.top;
+}
+
+template<typename TTile, int nTileExtent>
+std::size_t CTileDirectory<TTile, nTileExtent>::DirectoryIndex(rbt::point<int> const& ptBlock) const {
+    ASSERT(InDirectory(ptBlock));
+    auto const nWidth = m_rectnDirectory.right - m_rectnDirectory.left + 1;
+    return (ptBlock.y - m_rectnDirectory.bottom) * nWidth + (ptBlock.x - m_rectnDirectory.left);
+}
+
+template<typename TTile, int nTileExtent>
+void CTileDirectory<TTile, nTileExtent>::GrowDirectory(rbt::point<int> const& ptBlock) {
+    // Grow by a block in each direction to amortize reallocations
+    int constexpr c_nGrowBy = 1;
+    auto rectnNew = m_rectnDirectory;
+    rectnNew |= ptBlock - rbt::size<int>(c_nGrowBy, c_nGrowBy);
+    rectnNew |= ptBlock + rbt::size<int>(c_nGrowBy, c_nGrowBy);
+
+    auto const nWidth = rectnNew.right - rectnNew.left + 1;
+    std::vector<std::shared_ptr<SBlock>> vecpblock((rectnNew.top - rectnNew.bottom + 1) * nWidth);
+    if(!m_vecpblock.empty()) {
+        for(int y = m_rectnDirectory.bottom; y <= m_rectnDirectory.top; ++y) {
+            for(int x = m_rectnDirectory.left; x <= m_rectnDirectory.right; ++x) {
+                vecpblock[(y - rectnNew.bottom) * nWidth + (x - rectnNew.left)]
+                    = std::move(m_vecpblock[DirectoryIndex(rbt::point<int>(x, y))]);
+            }
+        }
+    }
+    m_rectnDirectory = rectnNew;
+    m_vecpblock = std::move(vecpblock);
+}
+
+template<typename TTile, int nTileExtent>
+TTile const* CTileDirectory<TTile, nTileExtent>::tile(rbt::point<int> const& ptTile) const {
+    auto const ptBlock = BlockCoordinate(ptTile);
+    if(!InDirectory(ptBlock)) return nullptr;
+    auto const& pblock = m_vecpblock[DirectoryIndex(ptBlock)];
+    return pblock ? pblock->m_aptile[TileIndex(ptTile)].get() : nullptr;
+}
+
+template<typename TTile, int nTileExtent>
+typename CTileDirectory<TTile, nTileExtent>::SBlock& CTileDirectory<TTile, nTileExtent>::mutable_block(rbt::point<int> const& ptTile) {
+    auto const ptBlock = BlockCoordinate(ptTile);
+    if(!InDirectory(ptBlock)) GrowDirectory(ptBlock);
+
+    auto& pblock = m_vecpblock[DirectoryIndex(ptBlock)];
+    if(!pblock) {
+        pblock = std::make_shared<SBlock>();
+    } else if(1<pblock.use_count()) {
+        // Block is shared with another directory, copy on write.
+        // The copy shares all tiles with the original block.
+        pblock = std::make_shared<SBlock>(*pblock);
+    }
+    return *pblock;
+}
+
+template<typename TTile, int nTileExtent>
+template<typename FInit>
+TTile& CTileDirectory<TTile, nTileExtent>::mutable_tile(rbt::point<int> const& ptTile, FInit fnInit) {
+    auto& ptile = mutable_block(ptTile).m_aptile[TileIndex(ptTile)];
+    if(!ptile) {
+        ptile = std::make_shared<TTile>();
+        fnInit(*ptile);
+    } else if(1<ptile.use_count()) {
+        // Tile is shared with another directory, copy on write.
+        // Directories are only copied while nobody modifies them, e.g. when
+        // resampling particles, so use_count is reliable here.
+        ptile = std::make_shared<TTile>(*ptile);
+    }
+    return *ptile;
+}
+
+template<typename TTile, int nTileExtent>
+void CTileDirectory<TTile, nTileExtent>::set_tile(rbt::point<int> const& ptTile, std::shared_ptr<TTile> ptile) {
+    mutable_block(ptTile).m_aptile[TileIndex(ptTile)] = std::move(ptile);
+}
+
+template<typename TTile, int nTileExtent>
+std::size_t CTileDirectory<TTile, nTileExtent>::TileCount() const {
+    std::size_t ctile = 0;
+    ForEachTile([&](rbt::point<int> const&, TTile const&) { ++ctile; });
+    return ctile;
+}
+
+template<typename TTile, int nTileExtent>
+rbt::rect<int> CTileDirectory<TTile, nTileExtent>::TileBounds() const {
+    if(m_rectnDirectory.right<m_rectnDirectory.left) return rbt::rect<int>::empty();
+    return rbt::rect<int>{
+        m_rectnDirectory.left*c_nBlockExtent, m_rectnDirectory.bottom*c_nBlockExtent,
+        (m_rectnDirectory.right + 1)*c_nBlockExtent - 1, (m_rectnDirectory.top + 1)*c_nBlockExtent - 1
+    };
+}
+
+template<typename TTile, int nTileExtent>
+template<typename Func>
+void CTileDirectory<TTile, nTileExtent>::ForEachTile(Func fn) const {
+    for(int y = m_rectnDirectory.bottom; y <= m_rectnDirectory.top; ++y) {
+        for(int x = m_rectnDirectory.left; x <= m_rectnDirectory.right; ++x) {
+            rbt::point<int> const ptBlock(x, y);
+            auto const& pblock = m_vecpblock[DirectoryIndex(ptBlock)];
+            if(!pblock) continue;
+            for(int i = 0; i < c_nBlockExtent*c_nBlockExtent; ++i) {
+                if(auto const& ptile = pblock->m_aptile[i]) {
+                    fn(
+                        rbt::point<int>(ptBlock.x*c_nBlockExtent + i%c_nBlockExtent, ptBlock.y*c_nBlockExtent + i/c_nBlockExtent),
+                        static_cast<TTile const&>(*ptile)
+                    );
+                }
+            }
+        }
+    }
+}
+
+////////////////////
+// CTiledGrid
+template<typename T>
+CTiledGrid<T>::CTiledGrid(T tDefault)
+    : m_tDefault(tDefault)
+{}
+
+template<typename T>
+T CTiledGrid<T>::at(rbt::point<int> const& pt) const {
+    auto const* ptile = m_dirtile.tile(CTileDirectory<STile>::TileCoordinate(pt));
+    return ptile ? (*ptile)[CTileDirectory<STile>::CellIndex(pt)] : m_tDefault;
+}
+
+template<typename T>
+T& CTiledGrid<T>::ref(rbt::point<int> const& pt) {
+    auto& tile = m_dirtile.mutable_tile(
+        CTileDirectory<STile>::TileCoordinate(pt),
+        [&](STile& tile) { tile.fill(m_tDefault); }
+    );
+    return tile[CTileDirectory<STile>::CellIndex(pt)];
+}
+
+template<typename T>
+rbt::rect<int> CTiledGrid<T>::bounds() const {
+    auto rectn = rbt::rect<int>::empty();
+    ForEachTile([&](rbt::point<int> const& ptOrigin, T const*) {
+        rectn |= ptOrigin;
+        rectn |= ptOrigin + rbt::size<int>(c_nTileExtent-1, c_nTileExtent-1);
+    });
+    return rectn;
+}
+
+template<typename T>
+cv::Mat CTiledGrid<T>::ToMat(rbt::rect<int> const& rectn) const {
+    cv::Mat mat(
+        rectn.top - rectn.bottom + 1,
+        rectn.right - rectn.left + 1,
+        cv::DataType<T>::type,
+        cv::Scalar(m_tDefault)
+    );
+    ForEachRowSegment(rectn, [&](rbt::point<int> const& ptBegin, T const* pt, int cn) {
+        std::copy(pt, pt + cn, mat.ptr<T>(ptBegin.y - rectn.bottom) + (ptBegin.x - rectn.left));
+    });
+    return mat;
+}
+
+template<typename T>
+template<typename Func>
+void CTiledGrid<T>::ForEachTile(Func fn) const {
+    m_dirtile.ForEachTile([&](rbt::point<int> const& ptTile, STile const& tile) {
+        fn(ptTile * c_nTileExtent, tile.data());
+    });
+}
+
+template<typename T>
+template<typename Func>
+void CTiledGrid<T>::ForEachRowSegment(rbt::rect<int> const& rectn, Func fn) const {
+    if(rectn.right<rectn.left || rectn.top<rectn.bottom) return;
+
+    // Only visit the tiles overlapping rectn, the cost grows with the size of rectn, not of the grid
+    auto const rectnTiles = m_dirtile.TileBounds();
+    auto const ptTileMin = CTileDirectory<STile>::TileCoordinate(rbt::point<int>(rectn.left, rectn.bottom));
+    auto const ptTileMax = CTileDirectory<STile>::TileCoordinate(rbt::point<int>(rectn.right, rectn.top));
+    for(int yTile = std::max(ptTileMin.y, rectnTiles.bottom); yTile <= std::min(ptTileMax.y, rectnTiles.top); ++yTile) {
+        for(int xTile = std::max(ptTileMin.x, rectnTiles.left); xTile <= std::min(ptTileMax.x, rectnTiles.right); ++xTile) {
+            auto const* ptile = m_dirtile.tile(rbt::point<int>(xTile, yTile));
+            if(!ptile) continue;
+
+            rbt::point<int> const ptOrigin(xTile * c_nTileExtent, yTile * c_nTileExtent);
+            auto const nLeft = std::max(rectn.left, ptOrigin.x);
+            auto const nRight = std::min(rectn.right, ptOrigin.x + c_nTileExtent - 1);
+            auto const nBottom = std::max(rectn.bottom, ptOrigin.y);
+            auto const nTop = std::min(rectn.top, ptOrigin.y + c_nTileExtent - 1);
+            for(int y = nBottom; y <= nTop; ++y) {
+                fn(
+                    rbt::point<int>(nLeft, y),
+                    ptile->data() + (y - ptOrigin.y)*c_nTileExtent + (nLeft - ptOrigin.x),
+                    nRight - nLeft + 1
+                );
+            }
+        }
+    }
+}
+
+template<typename T>
+template<typename Func>
+void CTiledGrid<T>::ModifyRow(rbt::point<int> const& ptBegin, int cn, Func fn) {
+    auto pt = ptBegin;
+    auto const nEnd = ptBegin.x + cn;
+    while(pt.x < nEnd) {
+        auto const ptTile = CTileDirectory<STile>::TileCoordinate(pt);
+        auto const cnSegment = std::min(nEnd, (ptTile.x + 1) * c_nTileExtent) - pt.x;
+        auto& tile = m_dirtile.mutable_tile(ptTile, [&](STile& tile) { tile.fill(m_tDefault); });
+        fn(pt, tile.data() + CTileDirectory<STile>::CellIndex(pt), cnSegment);
+        pt.x += cnSegment;
+    }
+}